@@ -3,7 +3,12 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* A block device. */
 struct block
@@ -19,6 +24,13 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, if block_enable_queue() was called. */
+    bool queued;                        /* Requests go through queue? */
+    struct list queue;                  /* Requests sorted by sector. */
+    struct lock queue_lock;             /* Protects queue and head. */
+    struct condition queue_cond;        /* Signaled when queue grows. */
+    block_sector_t head;                /* Sector after last transfer. */
   };
 
 /* List of all block devices. */
@@ -28,6 +40,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, bool write, block_sector_t,
+                      void *, block_sector_t cnt);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +134,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +145,261 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  block_write_multi (block, sector, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it do so with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, void *buffer,
+                  block_sector_t cnt)
+{
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  transfer (block, false, sector, buffer, cnt);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it do so with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   const void *buffer, block_sector_t cnt)
+{
+  if (cnt == 0)
+    return;
   check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, true, sector, (void *) buffer, cnt);
+  block->write_cnt += cnt;
+}
+
+/* Request queue. */
+
+/* Most sectors the dispatcher merges into one transfer. */
+#define MERGE_MAX 64
+
+/* Timer ticks a request may wait before it is served ahead of
+   the elevator order. */
+#define DEADLINE (TIMER_FREQ / 2)
+
+/* A request waiting in a block device's queue. */
+struct request
+  {
+    struct list_elem elem;              /* Element in queue. */
+    bool write;                         /* Write, or read? */
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    void *buffer;                       /* CNT sectors of data. */
+    int64_t submitted;                  /* When it was queued. */
+    struct semaphore done;              /* Up'd when complete. */
+  };
+
+/* Performs a transfer of CNT sectors starting at SECTOR between
+   BLOCK and BUFFER through BLOCK's driver. */
+static void
+do_transfer (struct block *block, bool write, block_sector_t sector,
+             void *buffer, block_sector_t cnt)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = buffer;
+  block_sector_t i;
+
+  if (write && ops->write_multi != NULL)
+    ops->write_multi (block->aux, sector, buffer, cnt);
+  else if (!write && ops->read_multi != NULL)
+    ops->read_multi (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++, p += BLOCK_SECTOR_SIZE)
+      if (write)
+        ops->write (block->aux, sector + i, p);
+      else
+        ops->read (block->aux, sector + i, p);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER and returns when done.  If BLOCK has a request queue,
+   the transfer is queued for its dispatcher thread; otherwise it
+   is done directly. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          void *buffer, block_sector_t cnt)
+{
+  struct request r;
+  struct list_elem *e;
+
+  if (!block->queued)
+    {
+      do_transfer (block, write, sector, buffer, cnt);
+      return;
+    }
+
+  r.write = write;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.submitted = timer_ticks ();
+  sema_init (&r.done, 0);
+
+  /* Keep the queue sorted by sector. */
+  lock_acquire (&block->queue_lock);
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct request, elem)->sector > sector)
+      break;
+  list_insert (e, &r.elem);
+  cond_signal (&block->queue_cond, &block->queue_lock);
+  lock_release (&block->queue_lock);
+
+  sema_down (&r.done);
+}
+
+/* Removes and returns the next request to serve from BLOCK's
+   queue, which must not be empty.  Requests are normally served
+   in C-LOOK order: in increasing sector order from the last
+   position, then wrapping around to the lowest sector.  A request
+   that has waited DEADLINE ticks or more is served first, so that
+   a stream of requests ahead of the head cannot starve it.
+   BLOCK's queue_lock must be held. */
+static struct request *
+pick_request (struct block *block)
+{
+  struct request *next = NULL, *oldest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct request *r = list_entry (e, struct request, elem);
+      if (next == NULL && r->sector >= block->head)
+        next = r;
+      if (oldest == NULL || r->submitted < oldest->submitted)
+        oldest = r;
+    }
+  if (timer_elapsed (oldest->submitted) >= DEADLINE)
+    next = oldest;
+  else if (next == NULL)
+    next = list_entry (list_front (&block->queue), struct request, elem);
+
+  list_remove (&next->elem);
+  return next;
+}
+
+/* Dispatcher thread for block device BLOCK_.  Takes requests from
+   the queue in elevator order, merging each with the queued
+   requests in the same direction for the sectors right after it,
+   and hands them to the driver. */
+static void
+dispatch (void *block_)
+{
+  struct block *block = block_;
+  uint8_t *bounce = palloc_get_multiple (PAL_ASSERT,
+                                         MERGE_MAX * BLOCK_SECTOR_SIZE
+                                         / PGSIZE);
+
+  for (;;)
+    {
+      struct request *batch[MERGE_MAX];
+      size_t batch_cnt, i;
+      block_sector_t sector, cnt;
+      bool write;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      batch[0] = pick_request (block);
+      batch_cnt = 1;
+      write = batch[0]->write;
+      sector = batch[0]->sector;
+      cnt = batch[0]->cnt;
+
+      /* Since the queue is sorted, requests that continue this one
+         are the ones that now follow its position. */
+      while (cnt < MERGE_MAX && !list_empty (&block->queue))
+        {
+          struct request *r = NULL;
+          struct list_elem *e;
+
+          for (e = list_begin (&block->queue); e != list_end (&block->queue);
+               e = list_next (e))
+            {
+              struct request *q = list_entry (e, struct request, elem);
+              if (q->sector > sector + cnt)
+                break;
+              if (q->sector == sector + cnt && q->write == write
+                  && cnt + q->cnt <= MERGE_MAX)
+                {
+                  r = q;
+                  break;
+                }
+            }
+          if (r == NULL)
+            break;
+          list_remove (&r->elem);
+          batch[batch_cnt++] = r;
+          cnt += r->cnt;
+        }
+      block->head = sector + cnt;
+      lock_release (&block->queue_lock);
+
+      if (batch_cnt == 1)
+        do_transfer (block, write, sector, batch[0]->buffer, cnt);
+      else
+        {
+          /* Gather the requests' buffers into one transfer. */
+          uint8_t *p;
+
+          if (write)
+            for (i = 0, p = bounce; i < batch_cnt; i++)
+              {
+                memcpy (p, batch[i]->buffer, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+                p += batch[i]->cnt * BLOCK_SECTOR_SIZE;
+              }
+          do_transfer (block, write, sector, bounce, cnt);
+          if (!write)
+            for (i = 0, p = bounce; i < batch_cnt; i++)
+              {
+                memcpy (batch[i]->buffer, p, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+                p += batch[i]->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      for (i = 0; i < batch_cnt; i++)
+        sema_up (&batch[i]->done);
+    }
+}
+
+/* Gives BLOCK a request queue served by its own dispatcher
+   thread, so that concurrent requests are reordered to reduce
+   seeking and adjacent ones are merged.  Meant for drivers of
+   physical disks; devices layered on top of another block
+   device, such as partitions, pass requests straight through to
+   that device's queue instead. */
+void
+block_enable_queue (struct block *block)
+{
+  char name[16];
+
+  ASSERT (!block->queued);
+
+  list_init (&block->queue);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  block->head = 0;
+  block->queued = true;
+
+  snprintf (name, sizeof name, "io-%.12s", block->name);
+  thread_create (name, PRI_DEFAULT, dispatch, block);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -200,6 +463,7 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queued = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
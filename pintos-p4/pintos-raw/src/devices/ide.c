@@ -8,7 +8,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +32,16 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus-master IDE port addresses, found through PCI. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +57,31 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_ST_ERROR 0x02        /* Transfer failed (write 1 to clear). */
+#define BM_ST_INTR 0x04         /* Disk interrupted (write 1 to clear). */
+#define BM_ST_DRV_DMA 0x60      /* Drives 0 and 1 are DMA capable. */
+
+/* A physical region descriptor: one entry of the table that
+   tells the bus-master controller where to move data. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT or 0. */
+  };
+#define PRD_EOT 0x8000          /* Last entry in table. */
+
+/* Most sectors a single READ/WRITE SECTOR command can transfer.
+   (A sector count of 0 in the command means 256.) */
+#define MAX_SECTORS_PER_CMD 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +90,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer by bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +100,8 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus-master I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, if bm_base is nonzero. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -84,12 +120,24 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static uint16_t find_bus_master (void);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void ide_read_multi (void *, block_sector_t, void *, block_sector_t);
+static void ide_write_multi (void *, block_sector_t, const void *,
+                             block_sector_t);
+static void pio_read (struct ata_disk *, block_sector_t, uint8_t *,
+                      block_sector_t);
+static void pio_write (struct ata_disk *, block_sector_t, const uint8_t *,
+                       block_sector_t);
+static bool dma_transfer (struct ata_disk *, block_sector_t, const void *,
+                          block_sector_t, bool read);
+
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
@@ -101,6 +149,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +175,12 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Each channel has 8 bus-master ports and its own PRD
+         table.  A page-aligned table never crosses the 64 kB
+         boundary that the controller forbids. */
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = bm_base != 0 ? palloc_get_page (PAL_ASSERT) : NULL;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +191,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -303,12 +359,83 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use DMA if both the controller and the disk support it
+     (IDENTIFY DEVICE word 49, bit 8). */
+  d->use_dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_enable_queue (block);
   partition_scan (block);
 }
 
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at byte offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit register at byte offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0
+   to VALUE. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can act as a bus
+   master, such as the PIIX3 that QEMU and Bochs emulate.  If one
+   is found, enables bus mastering and returns the I/O port of its
+   bus-master registers (BAR4).  Otherwise, returns 0, and the
+   disks are driven in PIO mode only. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          {
+            /* No such function.  Function 0 absent means no
+               device at all. */
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Class 01h (mass storage), subclass 01h (IDE), with
+           programming interface bit 7 (bus master) set. */
+        class = pci_read_config (dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        /* BAR4 must be an I/O space BAR. */
+        bar4 = pci_read_config (dev, func, 0x20);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -342,58 +469,215 @@ descramble_ata_string (char *string, int size)
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d, sec_no, buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d, sec_no, buffer, 1);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Uses
+   bus-master DMA if D supports it, and otherwise one READ SECTOR
+   command per MAX_SECTORS_PER_CMD sectors.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no, void *buffer_,
+                block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+
+      if (!dma_transfer (d, sec_no, buffer, n, true))
+        pio_read (d, sec_no, buffer, n);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, by DMA if D
+   supports it and otherwise with one WRITE SECTOR command per
+   MAX_SECTORS_PER_CMD sectors.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d_, block_sector_t sec_no, const void *buffer_,
+                 block_sector_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < MAX_SECTORS_PER_CMD ? cnt : MAX_SECTORS_PER_CMD;
+
+      if (!dma_transfer (d, sec_no, buffer, n, false))
+        pio_write (d, sec_no, buffer, n);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors, at most MAX_SECTORS_PER_CMD, starting at
+   SEC_NO from disk D into BUFFER in PIO mode.  The disk
+   interrupts once per sector, when that sector is ready to be
+   transferred.  D's channel must be locked. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, uint8_t *buffer,
+          block_sector_t cnt)
+{
+  struct channel *c = d->channel;
+  block_sector_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      input_sector (c, buffer);
+      buffer += BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes CNT sectors, at most MAX_SECTORS_PER_CMD, starting at
+   SEC_NO to disk D from BUFFER in PIO mode.  D's channel must be
+   locked. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, const uint8_t *buffer,
+           block_sector_t cnt)
+{
+  struct channel *c = d->channel;
+  block_sector_t i;
+
+  select_sectors (d, sec_no, cnt);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      output_sector (c, buffer);
+      buffer += BLOCK_SECTOR_SIZE;
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Transfers CNT sectors, at most MAX_SECTORS_PER_CMD, starting at
+   SEC_NO between disk D and BUFFER by bus-master DMA: from disk
+   to memory if READ is true, the other way if it is false.  The
+   controller moves the data while the calling thread sleeps
+   until the completion interrupt.  D's channel must be locked.
+
+   Returns false without doing anything if D cannot do DMA or
+   BUFFER is not suitably aligned, so that the caller falls back
+   to PIO.  Also returns false, and turns DMA off for D, if the
+   transfer fails. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, const void *buffer,
+              block_sector_t cnt, bool read)
+{
+  struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+  size_t left = cnt * BLOCK_SECTOR_SIZE;
+  struct prd *prd = c->prdt;
+  uint8_t direction = read ? BM_CMD_READ : 0;
+  uint8_t bm_status, status;
+
+  if (!d->use_dma || (uintptr_t) buffer % 2 != 0)
+    return false;
+
+  /* Describe BUFFER to the controller.  Kernel virtual memory maps
+     physical memory one-to-one, so BUFFER is physically
+     contiguous, but a region may not cross a 64 kB boundary. */
+  while (left > 0)
+    {
+      uint32_t addr = vtop (p);
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > left)
+        chunk = left;
+      prd->addr = addr;
+      prd->size = chunk & 0xffff;       /* 0 means 64 kB. */
+      prd->flags = 0;
+      prd++;
+      p += chunk;
+      left -= chunk;
+    }
+  prd[-1].flags = PRD_EOT;
+
+  /* Program the controller, issue the command, then start the
+     transfer and wait for it to complete. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        (inb (reg_bm_status (c)) & BM_ST_DRV_DMA) | BM_ST_ERROR | BM_ST_INTR);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
   sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  outb (reg_bm_command (c), direction);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c),
+        (bm_status & BM_ST_DRV_DMA) | BM_ST_ERROR | BM_ST_INTR);
+  status = inb (reg_status (c));
+  if ((bm_status & BM_ST_ERROR) || (status & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, read ? "read" : "write", sec_no);
+      d->use_dma = false;
+      return false;
+    }
+  return true;
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_SECTORS_PER_CMD, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no,
+                block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -415,11 +699,13 @@ issue_pio_command (struct channel *c, uint8_t command)
 }
 
 /* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes.
+   Uses 32-bit transfers, which halve the number of port reads
+   compared to 16-bit ones. */
 static void
 input_sector (struct channel *c, void *sector) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insl (reg_data (c), sector, BLOCK_SECTOR_SIZE / 4);
 }
 
 /* Writes SECTOR to channel C's data register in PIO mode.
@@ -427,7 +713,7 @@ input_sector (struct channel *c, void *sector)
 static void
 output_sector (struct channel *c, const void *sector) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsl (reg_data (c), sector, BLOCK_SECTOR_SIZE / 4);
 }
 
 /* Low-level ATA primitives. */
@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -24,6 +25,18 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* A thread waiting in timer_sema_down(). */
+struct alarm
+  {
+    struct list_elem elem;      /* Element in alarm_list. */
+    int64_t wakeup;             /* Tick at which to give up waiting. */
+    struct semaphore *sema;     /* Semaphore to up then. */
+    bool fired;                 /* Upped by the timer? */
+  };
+
+/* Pending alarms, soonest first.  Accessed with interrupts off. */
+static struct list alarm_list;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -37,6 +50,7 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  list_init (&alarm_list);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -96,6 +110,44 @@ timer_sleep (int64_t ticks)
     thread_yield ();
 }
 
+/* Returns true if alarm A goes off before alarm B. */
+static bool
+alarm_less (const struct list_elem *a, const struct list_elem *b,
+            void *aux UNUSED)
+{
+  return (list_entry (a, struct alarm, elem)->wakeup
+          < list_entry (b, struct alarm, elem)->wakeup);
+}
+
+/* Downs SEMA, waiting at most approximately TICKS timer ticks
+   for it to be upped.  Blocks instead of polling in the
+   meantime.  If the wait times out, the timer ups SEMA itself;
+   if that races with another up, a later down returns at once,
+   so SEMA should only be used to wake a thread that tolerates an
+   extra wakeup.  Interrupts must be turned on. */
+void
+timer_sema_down (struct semaphore *sema, int64_t ticks)
+{
+  struct alarm alarm;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  alarm.wakeup = timer_ticks () + ticks;
+  alarm.sema = sema;
+  alarm.fired = false;
+  list_insert_ordered (&alarm_list, &alarm.elem, alarm_less, NULL);
+  intr_set_level (old_level);
+
+  sema_down (sema);
+
+  old_level = intr_disable ();
+  if (!alarm.fired)
+    list_remove (&alarm.elem);
+  intr_set_level (old_level);
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void
@@ -172,6 +224,17 @@ timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
   thread_tick ();
+
+  while (!list_empty (&alarm_list))
+    {
+      struct alarm *a = list_entry (list_front (&alarm_list),
+                                    struct alarm, elem);
+      if (a->wakeup > ticks)
+        break;
+      list_pop_front (&alarm_list);
+      a->fired = true;
+      sema_up (a->sema);
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
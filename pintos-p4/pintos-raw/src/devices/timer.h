@@ -4,6 +4,8 @@
 #include <round.h>
 #include <stdint.h>
 
+struct semaphore;
+
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
@@ -18,6 +20,7 @@ void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+void timer_sema_down (struct semaphore *, int64_t ticks);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
@@ -12,6 +12,36 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Prints the entry described by REC, which is in directory DIR,
+   with its type, size, and inumber if VERBOSE is true. */
+static void
+print_entry (const char *dir, const struct readdir_record *rec,
+             bool verbose) 
+{
+  printf ("%s", rec->name); 
+  if (verbose) 
+    {
+      printf (": ");
+      if (rec->isdir)
+        printf ("directory");
+      else
+        {
+          char full_name[128];
+          int entry_fd;
+
+          snprintf (full_name, sizeof full_name, "%s/%s", dir, rec->name);
+          entry_fd = open (full_name);
+          if (entry_fd != -1)
+            printf ("%d-byte file", filesize (entry_fd));
+          else
+            printf ("open failed");
+          close (entry_fd);
+        }
+      printf (", inumber %d", rec->inumber);
+    }
+  printf ("\n");
+}
+
 static bool
 list_dir (const char *dir, bool verbose) 
 {
@@ -24,38 +54,21 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      struct readdir_record records[16];
+      int bytes;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
+      /* Only files need opening, to find out their sizes. */
+      while ((bytes = readdir_batch (dir_fd, records, sizeof records)) > 0) 
         {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
-
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+          int i;
 
-              printf (": ");
-              if (entry_fd != -1)
-                {
-                  if (isdir (entry_fd))
-                    printf ("directory");
-                  else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
-                }
-              else
-                printf ("open failed");
-              close (entry_fd);
-            }
-          printf ("\n");
+          for (i = 0; i < bytes / (int) sizeof *records; i++)
+            print_entry (dir, &records[i], verbose);
         }
     }
   else 
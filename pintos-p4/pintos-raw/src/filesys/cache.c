@@ -0,0 +1,582 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Marks a cache entry that does not hold any sector. */
+#define INVALID_SECTOR ((block_sector_t) -1)
+
+/* A cached sector.
+
+   SECTOR, PIN_CNT and ACCESSED are protected by cache_lock.
+   DIRTY, META and the contents of DATA are protected by LOCK,
+   which may only be acquired by a thread that has pinned the
+   entry.  An entry with a nonzero PIN_CNT is never evicted, so
+   its SECTOR does not change while it is pinned.
+
+   A dirty entry with META set holds file system metadata that
+   has not been journaled yet.  Only a journal commit may write
+   it back, so eviction and flushing pass it over. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Cached sector or INVALID_SECTOR. */
+    int pin_cnt;                /* Threads using or waiting on entry. */
+    bool accessed;              /* Recently used, for clock eviction. */
+    bool dirty;                 /* Differs from disk? */
+    bool meta;                  /* Dirty metadata, awaiting commit? */
+    struct lock lock;           /* Protects DIRTY and DATA. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+  };
+
+static struct cache_entry cache[CACHE_CNT];
+
+/* Protects the sector mapping and the clock hand. */
+static struct lock cache_lock;
+
+/* Next entry the clock algorithm will consider for eviction. */
+static size_t clock_hand;
+
+/* Sectors waiting to be read ahead, as a ring buffer.
+   Requests that arrive while it is full are dropped, since
+   read-ahead is only a hint. */
+#define READAHEAD_CNT CACHE_CNT
+
+/* Most consecutive sectors read ahead with one disk command. */
+#define READAHEAD_RUN 8
+static block_sector_t readahead_queue[READAHEAD_CNT];
+static size_t readahead_head;           /* Next request to serve. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct lock readahead_lock;      /* Protects the queue. */
+static struct condition readahead_cond; /* Signaled when queue grows. */
+
+static void readahead_daemon (void *aux);
+
+/* Timer ticks between periodic write-behind flushes. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* The flusher sleeps on FLUSH_SEMA between flushes.
+   FLUSH_URGENT is set, under cache_lock, when eviction runs short
+   of clean entries and the flusher has been woken to run ahead of
+   its period; the flusher clears it. */
+static struct semaphore flush_sema;
+static bool flush_urgent;
+
+/* Number of entries with META set.  Protected by cache_lock. */
+static size_t meta_cnt;
+
+static void flush_daemon (void *aux);
+static void wake_flusher (void);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *base;
+  size_t i;
+
+  base = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_CNT * BLOCK_SECTOR_SIZE / PGSIZE);
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->sector = INVALID_SECTOR;
+      e->pin_cnt = 0;
+      e->accessed = false;
+      e->dirty = false;
+      e->meta = false;
+      lock_init (&e->lock);
+      e->data = base + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+  meta_cnt = 0;
+
+  lock_init (&readahead_lock);
+  cond_init (&readahead_cond);
+  readahead_head = readahead_cnt = 0;
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+
+  sema_init (&flush_sema, 0);
+  flush_urgent = false;
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* Unpins E.  E's lock must already have been released. */
+static void
+unpin (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Writes E back to disk if it is dirty.
+   E's lock must be held. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      if (e->meta)
+        {
+          e->meta = false;
+          lock_acquire (&cache_lock);
+          meta_cnt--;
+          lock_release (&cache_lock);
+        }
+    }
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held,
+   loading it into the cache first if necessary.  If READ_IN is
+   false, a newly loaded entry is not read from disk because the
+   caller is about to overwrite all of it.  If LOADED is nonnull,
+   sets *LOADED to true if the entry was newly loaded, false if
+   SECTOR was already cached. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read_in, bool *loaded)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      size_t i;
+
+      lock_acquire (&cache_lock);
+
+      /* Already cached? */
+      for (i = 0; i < CACHE_CNT; i++)
+        {
+          e = &cache[i];
+          if (e->sector == sector)
+            {
+              e->pin_cnt++;
+              e->accessed = true;
+              lock_release (&cache_lock);
+              lock_acquire (&e->lock);
+              if (loaded != NULL)
+                *loaded = false;
+              return e;
+            }
+        }
+
+      /* Pick a victim with the clock algorithm.  Two full sweeps
+         are enough to clear every accessed bit once.  Clean
+         entries are preferred, so that writers do not wait for
+         write-backs that the flusher can do instead; a dirty entry
+         is taken only if no clean one turns up.  Unjournaled
+         metadata is never taken.  (DIRTY and META of an unpinned
+         entry only change while it is pinned, so reading them
+         under cache_lock is safe.) */
+      e = NULL;
+      for (i = 0; i < 2 * CACHE_CNT; i++)
+        {
+          struct cache_entry *c = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_CNT;
+          if (c->pin_cnt > 0 || c->meta)
+            continue;
+          if (c->accessed)
+            c->accessed = false;
+          else if (c->dirty)
+            {
+              if (e == NULL)
+                e = c;
+            }
+          else
+            {
+              e = c;
+              break;
+            }
+        }
+
+      if (e == NULL)
+        {
+          /* Every entry is in use or awaiting commit.  The journal
+             keeps enough entries out of the second group that the
+             first must soon let go of one. */
+          wake_flusher ();
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+
+      if (e->dirty)
+        {
+          wake_flusher ();
+
+          /* Write the victim back without holding cache_lock,
+             then start over, because the sector we want might
+             have been loaded in the meantime. */
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          write_back (e);
+          lock_release (&e->lock);
+          unpin (e);
+          continue;
+        }
+
+      /* Clean, unpinned victim: take it over.  Nobody else can
+         hold its lock, so acquiring it here does not block. */
+      e->sector = sector;
+      e->pin_cnt = 1;
+      e->accessed = true;
+      lock_acquire (&e->lock);
+      lock_release (&cache_lock);
+
+      if (read_in)
+        block_read (fs_device, sector, e->data);
+      if (loaded != NULL)
+        *loaded = true;
+      return e;
+    }
+}
+
+/* Releases E, which was obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  unpin (e);
+}
+
+/* Reads SIZE bytes of SECTOR, starting at byte OFS within the
+   sector, into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, NULL);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFS within the sector, marking it as metadata if META is
+   true. */
+static void
+write_at (block_sector_t sector, const void *buffer, off_t ofs, off_t size,
+          bool meta)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, NULL);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  if (meta && !e->meta)
+    {
+      /* Ask for a commit once half the cache awaits one, so that
+         journal_begin() rarely has to wait for room. */
+      e->meta = true;
+      lock_acquire (&cache_lock);
+      if (++meta_cnt >= CACHE_CNT / 2)
+        wake_flusher ();
+      lock_release (&cache_lock);
+      journal_charge ();
+    }
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFS within the sector.  The data reaches the disk when the
+   entry is evicted or the cache is flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                off_t ofs, off_t size)
+{
+  write_at (sector, buffer, ofs, size, false);
+}
+
+/* Writes SIZE bytes of file system metadata from BUFFER into
+   SECTOR, starting at byte OFS within the sector.  Must be called
+   within a journal transaction, or by the journal itself.  The
+   data reaches the disk through the journal, at the next
+   commit. */
+void
+cache_write_at_meta (block_sector_t sector, const void *buffer,
+                     off_t ofs, off_t size)
+{
+  write_at (sector, buffer, ofs, size, true);
+}
+
+/* Reads all of SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER into
+   SECTOR, as cache_write_at_meta(). */
+void
+cache_write_meta (block_sector_t sector, const void *buffer)
+{
+  cache_write_at_meta (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Pins and locks the entry at index I, if it holds a sector, and
+   returns it.  Returns a null pointer if it does not. */
+static struct cache_entry *
+grab (size_t i)
+{
+  struct cache_entry *e = &cache[i];
+
+  lock_acquire (&cache_lock);
+  if (e->sector == INVALID_SECTOR)
+    {
+      lock_release (&cache_lock);
+      return NULL;
+    }
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  return e;
+}
+
+/* Writes every dirty entry back to disk, except metadata that
+   is waiting for a journal commit. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = grab (i);
+      if (e == NULL)
+        continue;
+      if (!e->meta)
+        write_back (e);
+      cache_put (e);
+    }
+}
+
+/* Drops any cached copies of the CNT sectors starting at SECTOR,
+   which the caller has just written to disk directly.  The
+   sectors must be newly allocated, so that nobody else uses
+   them; a dirty copy left by a previous owner is thrown away. */
+void
+cache_discard (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->sector == INVALID_SECTOR || e->sector < sector
+          || e->sector >= sector + cnt)
+        continue;
+
+      /* The read-ahead thread may still be loading it. */
+      if (e->pin_cnt > 0)
+        {
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          i--;
+          continue;
+        }
+
+      if (e->meta)
+        meta_cnt--;
+      e->sector = INVALID_SECTOR;
+      e->accessed = e->dirty = e->meta = false;
+    }
+  lock_release (&cache_lock);
+}
+
+/* Returns the number of cached sectors holding metadata that
+   awaits a journal commit. */
+size_t
+cache_meta_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&cache_lock);
+  cnt = meta_cnt;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Copies every dirty metadata sector into DATA, which must have
+   room for cache_meta_cnt() sectors, and its sector number into
+   SECTORS.  Returns the number of sectors copied.  For the
+   journal, which must make sure that no transaction is running. */
+size_t
+cache_collect_meta (block_sector_t sectors[], void *data_)
+{
+  uint8_t *data = data_;
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = grab (i);
+      if (e == NULL)
+        continue;
+      if (e->dirty && e->meta)
+        {
+          sectors[cnt] = e->sector;
+          memcpy (data + cnt * BLOCK_SECTOR_SIZE, e->data, BLOCK_SECTOR_SIZE);
+          cnt++;
+        }
+      cache_put (e);
+    }
+  return cnt;
+}
+
+/* Writes every dirty metadata sector back in place.  For the
+   journal, once it has logged them. */
+void
+cache_write_back_meta (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = grab (i);
+      if (e == NULL)
+        continue;
+      if (e->meta)
+        write_back (e);
+      cache_put (e);
+    }
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache,
+   without waiting for it to do so. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_CNT)
+    {
+      readahead_queue[(readahead_head + readahead_cnt) % READAHEAD_CNT]
+        = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_cond, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache so that
+   the sequential reader that queued them finds them resident.
+   Consecutive queued sectors that are not cached yet are read
+   with a single multi-sector disk command. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  static uint8_t buffer[READAHEAD_RUN * BLOCK_SECTOR_SIZE];
+
+  for (;;)
+    {
+      block_sector_t sectors[READAHEAD_RUN];
+      struct cache_entry *run[READAHEAD_RUN];
+      size_t sector_cnt, run_cnt, i;
+
+      /* Take the longest consecutive run at the head of the
+         queue. */
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_cond, &readahead_lock);
+      sector_cnt = 0;
+      do
+        {
+          sectors[sector_cnt++] = readahead_queue[readahead_head];
+          readahead_head = (readahead_head + 1) % READAHEAD_CNT;
+          readahead_cnt--;
+        }
+      while (readahead_cnt > 0 && sector_cnt < READAHEAD_RUN
+             && (readahead_queue[readahead_head]
+                 == sectors[sector_cnt - 1] + 1));
+      lock_release (&readahead_lock);
+
+      /* Claim cache entries for the sectors without reading them.
+         Their locks stay held until the data is in, so nobody
+         sees them half loaded.  Sectors already cached are skipped
+         at the start of the run and end it anywhere else. */
+      run_cnt = 0;
+      for (i = 0; i < sector_cnt; i++)
+        {
+          bool loaded;
+          struct cache_entry *e = cache_get (sectors[i], false, &loaded);
+          if (!loaded)
+            {
+              cache_put (e);
+              if (run_cnt > 0)
+                break;
+              continue;
+            }
+          run[run_cnt++] = e;
+        }
+      if (run_cnt == 0)
+        continue;
+
+      block_read_multi (fs_device, run[0]->sector, buffer, run_cnt);
+      for (i = 0; i < run_cnt; i++)
+        {
+          memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                  BLOCK_SECTOR_SIZE);
+          cache_put (run[i]);
+        }
+    }
+}
+
+/* Wakes the flusher ahead of its period, unless it has been
+   woken already.  Must be called with cache_lock held. */
+static void
+wake_flusher (void)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (!flush_urgent)
+    {
+      flush_urgent = true;
+      sema_up (&flush_sema);
+    }
+}
+
+/* Write-behind thread.  Commits the journal and flushes dirty
+   entries every FLUSH_INTERVAL ticks, or sooner when eviction
+   finds the cache full of dirty entries, so that writers rarely
+   have to wait for the disk themselves.  Sleeps in between,
+   rather than polling. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sema_down (&flush_sema, FLUSH_INTERVAL);
+      lock_acquire (&cache_lock);
+      flush_urgent = false;
+      lock_release (&cache_lock);
+      journal_commit ();
+      cache_flush ();
+    }
+}
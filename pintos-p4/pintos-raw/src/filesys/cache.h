@@ -0,0 +1,37 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held in the cache. */
+#define CACHE_CNT 64
+
+void cache_init (void);
+void cache_flush (void);
+
+/* Whole-sector access. */
+void cache_read (block_sector_t, void *buffer);
+void cache_write (block_sector_t, const void *buffer);
+
+/* Partial-sector access. */
+void cache_read_at (block_sector_t, void *buffer, off_t ofs, off_t size);
+void cache_write_at (block_sector_t, const void *buffer,
+                     off_t ofs, off_t size);
+
+/* Sectors written to disk directly. */
+void cache_discard (block_sector_t, size_t cnt);
+
+/* Metadata, written back only through the journal. */
+void cache_write_meta (block_sector_t, const void *buffer);
+void cache_write_at_meta (block_sector_t, const void *buffer,
+                          off_t ofs, off_t size);
+size_t cache_meta_cnt (void);
+size_t cache_collect_meta (block_sector_t sectors[], void *data);
+void cache_write_back_meta (void);
+
+/* Asynchronous prefetching. */
+void cache_readahead (block_sector_t);
+
+#endif /* filesys/cache.h */
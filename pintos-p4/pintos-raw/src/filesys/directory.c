@@ -2,7 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -23,6 +27,43 @@ struct dir_entry
   bool in_use; /* In use or free? */
 };
 
+/* Directory entries never straddle sectors: each sector holds this
+   many, and its last few bytes go unused.
+
+   A directory starts out "linear", with at most one sector of
+   entries that are searched in order.  When it outgrows that, it
+   is converted to "hashed" format: DIR_BUCKET_CNT one-sector
+   buckets, where the entry for NAME lives in bucket
+   hash_string(NAME) % DIR_BUCKET_CNT or, if that bucket is full,
+   in the next bucket with room.  Buckets that have never held an
+   entry are holes in the directory's inode and take no space on
+   disk.  The formats are told apart by length, since a linear
+   directory is never longer than one sector.
+
+   The table does not grow, so a directory holds at most
+   DIR_MAX_ENTRIES entries, and dir_add() fails once it is full.
+
+   Each bucket counts, in the otherwise unused end of its sector,
+   the entries whose probe starts there but that live in a later
+   bucket.  A lookup reads NAME's own bucket and then only as many
+   more as it takes to see that many entries, so a miss reads one
+   bucket unless that bucket has overflowed.  A probe also ends at
+   a slot that has never been used (inode_sector == 0, which is the
+   free map's sector and so never a directory entry's). */
+#define ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define DIR_BUCKET_CNT 64
+#define DIR_MAX_ENTRIES (DIR_BUCKET_CNT * ENTRIES_PER_SECTOR)
+
+/* Byte offset within a bucket of its count of displaced
+   entries. */
+#define DISPLACED_OFS (ENTRIES_PER_SECTOR * sizeof (struct dir_entry))
+
+/* Most metadata sectors that adding an entry to a full linear
+   directory dirties: the directory's inode, its first and last
+   buckets, a bucket for each rehashed entry and one for the new
+   entry. */
+#define CONVERT_SECTOR_CNT (ENTRIES_PER_SECTOR + 4)
+
 /* Creates a directory in the given SECTOR.
 The directory's parent is in PARENT_SECTOR.
 Returns inode of created directory if successful,
@@ -117,44 +158,239 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns true if DIR is in hashed format, false if linear. */
+static bool
+is_hashed (const struct dir *dir)
+{
+  return inode_length (dir->inode) > BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of entry SLOT in bucket BUCKET. */
+static off_t
+slot_ofs (size_t bucket, size_t slot)
+{
+  return bucket * BLOCK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/* Returns the bucket that holds the entry at byte offset OFS. */
+static size_t
+ofs_bucket (off_t ofs)
+{
+  return ofs / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the bucket where probing for NAME starts. */
+static size_t
+name_bucket (const char *name)
+{
+  return hash_string (name) % DIR_BUCKET_CNT;
+}
+
+/* Returns the number of buckets to probe in DIR, and sets
+   *BUCKET to the first one to probe for NAME. */
+static size_t
+probe_start (const struct dir *dir, const char *name, size_t *bucket)
+{
+  if (!is_hashed (dir))
+    {
+      *bucket = 0;
+      return 1;
+    }
+  *bucket = name_bucket (name);
+  return DIR_BUCKET_CNT;
+}
+
+/* Returns the number of entries displaced from BUCKET of hashed
+   directory DIR into later buckets. */
+static uint32_t
+get_displaced (const struct dir *dir, size_t bucket)
+{
+  uint32_t cnt;
+
+  if (inode_read_at (dir->inode, &cnt, sizeof cnt,
+                     slot_ofs (bucket, 0) + DISPLACED_OFS) != sizeof cnt)
+    return 0;
+  return cnt;
+}
+
+/* Adds DELTA to the count of entries displaced from BUCKET of
+   hashed directory DIR.  Returns true if successful, false on
+   failure. */
+static bool
+add_displaced (struct dir *dir, size_t bucket, int delta)
+{
+  uint32_t cnt = get_displaced (dir, bucket) + delta;
+
+  return inode_write_at (dir->inode, &cnt, sizeof cnt,
+                         slot_ofs (bucket, 0) + DISPLACED_OFS)
+         == sizeof cnt;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Past NAME's own bucket, the search only goes on until it has
+   seen every entry displaced from there, or a slot that has
+   never been used, since NAME would have been put there or
+   earlier. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  size_t home, bucket, bucket_cnt, i, slot;
+  uint32_t displaced = 0;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  // printf("lookup\n");
-  // printf("cwd %x\n", thread_current()->cwd);
-  // for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-  //      ofs += sizeof e) 
-  // {
-  //   printf("name: %s\n", e.name);
-  // }
+  bucket_cnt = probe_start (dir, name, &home);
+  for (i = 0, bucket = home; i < bucket_cnt;
+       i++, bucket = (bucket + 1) % DIR_BUCKET_CNT)
+    {
+      for (slot = 0; slot < ENTRIES_PER_SECTOR; slot++)
+        {
+          off_t ofs = slot_ofs (bucket, slot);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-  {
-    if (e.in_use && !strcmp (name, e.name)) 
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+              || (!e.in_use && e.inode_sector == 0))
+            return false;
+          if (!e.in_use)
+            continue;
+          if (!strcmp (name, e.name)) 
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          if (i > 0 && displaced > 0 && name_bucket (e.name) == home)
+            displaced--;
+        }
+      if (i == 0)
+        displaced = get_displaced (dir, home);
+      if (displaced == 0)
+        return false;
+    }
+  return false;
+}
+
+/* Finds a slot in DIR where an entry for NAME may be written and
+   stores its byte offset in *OFSP.  Returns false if there is no
+   room, which for a linear directory means it must be converted
+   to hashed format first. */
+static bool
+find_free_slot (const struct dir *dir, const char *name, off_t *ofsp)
+{
+  struct dir_entry e;
+  size_t bucket, bucket_cnt, i, slot;
+
+  bucket_cnt = probe_start (dir, name, &bucket);
+  for (i = 0; i < bucket_cnt; i++, bucket = (bucket + 1) % DIR_BUCKET_CNT)
+    for (slot = 0; slot < ENTRIES_PER_SECTOR; slot++)
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        off_t ofs = slot_ofs (bucket, slot);
+
+        /* inode_read_at() only returns a short read at end of
+           file, where a linear directory can grow by one entry. */
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+            || !e.in_use)
+          {
+            *ofsp = ofs;
+            return true;
+          }
       }
-  }
   return false;
 }
 
+/* Converts DIR, a full linear directory, to hashed format by
+   rehashing its entries into DIR_BUCKET_CNT buckets.
+   Returns true if successful, false on failure.
+
+   There is no way to abort a journal transaction, so whatever
+   this writes is committed even if it fails.  It therefore
+   works out the new buckets in memory and allocates every sector
+   they need before writing any of them, so that running out of
+   memory or disk space leaves the directory linear and intact.
+   The first bucket, which replaces the linear entries, is written
+   last. */
+static bool
+convert_to_hashed (struct dir *dir)
+{
+  struct dir_entry *entries;
+  uint8_t bucket_of[ENTRIES_PER_SECTOR];
+  uint8_t slot_cnt[DIR_BUCKET_CNT];
+  uint32_t displaced[DIR_BUCKET_CNT];
+  uint8_t *block;
+  size_t cnt = 0, slot, i;
+  int bucket;
+  bool success = false;
+
+  entries = malloc (ENTRIES_PER_SECTOR * sizeof *entries);
+  block = malloc (BLOCK_SECTOR_SIZE);
+  if (entries == NULL || block == NULL)
+    goto done;
+
+  for (slot = 0; slot < ENTRIES_PER_SECTOR; slot++)
+    if (inode_read_at (dir->inode, &entries[cnt], sizeof *entries,
+                       slot_ofs (0, slot)) == sizeof *entries
+        && entries[cnt].in_use)
+      cnt++;
+
+  /* Place each entry where find_free_slot() would, adding them
+     one by one to an empty table. */
+  memset (slot_cnt, 0, sizeof slot_cnt);
+  memset (displaced, 0, sizeof displaced);
+  for (i = 0; i < cnt; i++)
+    {
+      size_t home = name_bucket (entries[i].name);
+      size_t b = home;
+      while (slot_cnt[b] == ENTRIES_PER_SECTOR)
+        b = (b + 1) % DIR_BUCKET_CNT;
+      if (b != home)
+        displaced[home]++;
+      bucket_of[i] = b;
+      slot_cnt[b]++;
+    }
+
+  /* Allocate the sectors of the first bucket, the last one, which
+     sets the length, and every bucket that gets an entry.  The
+     rest stay holes until used. */
+  for (bucket = 0; bucket < DIR_BUCKET_CNT; bucket++)
+    if ((slot_cnt[bucket] > 0 || bucket == 0
+         || bucket == DIR_BUCKET_CNT - 1)
+        && !inode_allocate (dir->inode, slot_ofs (bucket, 0),
+                            BLOCK_SECTOR_SIZE, false))
+      goto done;
+
+  /* Now fill them in, which cannot run out of space. */
+  for (bucket = DIR_BUCKET_CNT - 1; bucket >= 0; bucket--)
+    {
+      size_t n = 0;
+
+      if (slot_cnt[bucket] == 0 && bucket != 0
+          && bucket != DIR_BUCKET_CNT - 1)
+        continue;
+      memset (block, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < cnt; i++)
+        if (bucket_of[i] == bucket)
+          memcpy (block + slot_ofs (0, n++), &entries[i], sizeof *entries);
+      memcpy (block + DISPLACED_OFS, &displaced[bucket],
+              sizeof displaced[bucket]);
+      if (inode_write_at (dir->inode, block, BLOCK_SECTOR_SIZE,
+                          slot_ofs (bucket, 0)) != BLOCK_SECTOR_SIZE)
+        goto done;
+    }
+  success = true;
+
+ done:
+  free (block);
+  free (entries);
+  return success;
+}
 
 /* Searches DIR for a file with the given NAME
 and returns true if one exists, false otherwise.
@@ -171,13 +407,25 @@ struct inode **inode)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  inode_lock (dir->inode);
-  ok = lookup (dir, name, &e, NULL);
-  inode_unlock (dir->inode);
+  /* Consult the name cache before scanning the directory.  A
+     cached sector of 0 means NAME is known not to exist.  The
+     directory stays locked until the inode is open, so that
+     dir_remove() cannot unlink it, and a last close free its
+     sector, in between. */
+  inode_lock_shared (dir->inode);
+  if (dcache_lookup (inode_get_inumber (dir->inode), name, &e.inode_sector))
+    ok = e.inode_sector != 0;
+  else
+    {
+      ok = lookup (dir, name, &e, NULL);
+      dcache_insert (inode_get_inumber (dir->inode), name,
+                     ok ? e.inode_sector : 0);
+    }
 
   // printf("ok? %d\n", ok);
 
   *inode = ok ? inode_open (e.inode_sector) : NULL;
+  inode_unlock_shared (dir->inode);
   return *inode != NULL;
 }
 
@@ -185,8 +433,8 @@ struct inode **inode)
 file by that name. The file's inode is in sector
 INODE_SECTOR.
 Returns true if successful, false on failure.
-Fails if NAME is invalid (i.e. too long) or a disk or memory
-error occurs. */
+Fails if NAME is invalid (i.e. too long), DIR already holds
+DIR_MAX_ENTRIES entries, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
@@ -198,28 +446,40 @@ ASSERT (name != NULL);
 /* Check NAME for validity. */
 if (*name == '\0' || strchr (name, '/') || strlen (name) > NAME_MAX)
 return false;
-/* Check that NAME is not in use. */
+/* Check that NAME is not in use.  A linear directory with no
+room at its end may have to be converted, which takes a larger
+transaction. */
 inode_lock (dir->inode);
+if (!is_hashed (dir) && inode_length (dir->inode)
+    >= (off_t) (ENTRIES_PER_SECTOR * sizeof e))
+journal_begin_cnt (CONVERT_SECTOR_CNT);
+else
+journal_begin ();
 if (lookup (dir, name, NULL, NULL))
 goto done;
-/* Set OFS to offset of free slot.
-If there are no free slots, then it will be set to the
-current end-of-file.
-inode_read_at() will only return a short read at end of file.
-Otherwise, we'd need to verify that we didn't get a short
-read due to something intermittent such as low memory. */
-for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-ofs += sizeof e)
-if (!e.in_use)
-break;
+/* Set OFS to offset of free slot, switching a full linear
+directory to hashed format if need be. */
+if (!find_free_slot (dir, name, &ofs)
+&& (is_hashed (dir) || !convert_to_hashed (dir)
+|| !find_free_slot (dir, name, &ofs)))
+goto done;
+
+/* Count the entry as displaced before writing it, since a count
+that is too high only makes lookups read further. */
+if (is_hashed (dir) && ofs_bucket (ofs) != name_bucket (name)
+    && !add_displaced (dir, name_bucket (name), 1))
+goto done;
 
 /* Write slot. */
 e.in_use = true;
 strlcpy (e.name, name, sizeof e.name);
 e.inode_sector = inode_sector;
 success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+if (success)
+dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 //printf("success %s %d\n", name, success);
 done:
+journal_end ();
 inode_unlock (dir->inode);
 return success;
 }
@@ -241,6 +501,7 @@ if (!strcmp (name, ".") || !strcmp (name, ".."))
 return false;
 /* Find directory entry. */
 inode_lock (dir->inode);
+journal_begin ();
 if (!lookup (dir, name, &e, &ofs))
 goto done;
 /* Open inode. */
@@ -255,10 +516,15 @@ goto done;
 e.in_use = false;
 if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 goto done;
+/* If this fails, the count is left too high, which is harmless. */
+if (is_hashed (dir) && ofs_bucket (ofs) != name_bucket (name))
+add_displaced (dir, name_bucket (name), -1);
+dcache_insert (inode_get_inumber (dir->inode), name, 0);
 /* Remove inode. */
 inode_remove (inode);
 success = true;
 done:
+journal_end ();
 inode_unlock (dir->inode);
 inode_close (inode);
 return success;
@@ -269,19 +535,38 @@ NAME. Returns true if successful, false if the directory
 contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  return dir_readdir_entry (dir, name, NULL, NULL);
+}
+
+/* Like dir_readdir(), but also stores the entry's inode number
+   into *INUMBER and its type into *TYPE, for whichever of them is
+   nonnull.  Saves the caller opening each entry to find out. */
+bool
+dir_readdir_entry (struct dir *dir, char name[NAME_MAX + 1],
+                   block_sector_t *inumber, enum inode_type *type)
 {
   struct dir_entry e;
-  inode_lock (dir->inode);
+  inode_lock_shared (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
   {
+    /* Step to the next slot, skipping the unused end of a sector. */
     dir->pos += sizeof e;
+    if (dir->pos % BLOCK_SECTOR_SIZE + sizeof e > BLOCK_SECTOR_SIZE)
+      dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
     if (e.in_use /* && .....??? ..... */)
     {
-      inode_unlock (dir->inode);
+      /* Read the type before unlocking, while the entry still
+         keeps its inode from being removed. */
+      if (type != NULL)
+        *type = inode_get_type_at (e.inode_sector);
+      inode_unlock_shared (dir->inode);
       strlcpy (name, e.name, NAME_MAX + 1);
+      if (inumber != NULL)
+        *inumber = e.inode_sector;
       return true;
     }
   }
-  inode_unlock (dir->inode);
+  inode_unlock_shared (dir->inode);
   return false;
 }
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/inode.h"
 
 /* Maximum length of a file name component.
 This is the traditional UNIX maximum length.
@@ -26,5 +27,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+bool dir_readdir_entry (struct dir *, char name[NAME_MAX + 1],
+                        block_sector_t *, enum inode_type *);
 
 #endif /* filesys/directory.h */
@@ -3,6 +3,8 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include <stdbool.h>
 
 /* An open file. */
@@ -12,8 +14,13 @@ struct file
     off_t pos;                  /* Current position. */
     bool deny_dummy;            /* deny_write has "random" values without this */
     bool deny_write;            /* Has file_deny_write() been called? */   
+    off_t read_end;             /* Offset just past the last read. */
+    off_t readahead_end;        /* Offset read ahead up to. */
   };
 
+/* Number of sectors to read ahead of a sequential reader. */
+unsigned file_readahead_window = 8;
+
 /* Creates a file in the given SECTOR,
 initially LENGTH bytes long.
 Returns inode for the file on success, null pointer on failure.
@@ -35,11 +42,13 @@ file_create (block_sector_t sector, off_t length)
   {
     // char *zeros = calloc(length, sizeof(char));
     
-    int bytes_written = inode_write_at (inode, "", 1, length - 1);
-    if (bytes_written != 1) {
+    /* Lay the whole file out now, rather than a sector at a time
+       as it is written. */
+    if (!inode_allocate (inode, 0, length, true)) {
+      /* Closing the removed inode frees SECTOR along with
+         whatever was allocated. */
       inode_remove(inode);
       inode_close(inode);
-      free_map_release(sector);
       return NULL;
     }
 
@@ -63,6 +72,8 @@ file_open (struct inode *inode)
       file->pos = 0;
       file->deny_dummy = 0;
       file->deny_write = 0;
+      file->read_end = 0;
+      file->readahead_end = 0;
       return file;
     }
   else
@@ -102,6 +113,32 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Notes that BYTES_READ bytes were read from FILE at OFFSET.
+   If the read continued where the previous one left off, queues
+   the next file_readahead_window sectors for read-ahead, skipping
+   any that earlier calls already queued. */
+static void
+file_note_read (struct file *file, off_t offset, off_t bytes_read)
+{
+  bool sequential = offset == file->read_end;
+  off_t window_end;
+
+  file->read_end = offset + bytes_read;
+  if (!sequential || bytes_read == 0 || file_readahead_window == 0)
+    return;
+
+  window_end = file->read_end
+               + (off_t) file_readahead_window * BLOCK_SECTOR_SIZE;
+  if (file->readahead_end < file->read_end)
+    file->readahead_end = file->read_end;
+  if (file->readahead_end < window_end)
+    {
+      inode_readahead (file->inode, file->readahead_end,
+                       window_end - file->readahead_end);
+      file->readahead_end = window_end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -112,6 +149,7 @@ file_read (struct file *file, void *buffer, off_t size)
 {
   // printf("FILE_READ size %zu\n", size);
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_note_read (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -124,7 +162,9 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_note_read (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -157,6 +197,78 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, into DST at its current position, advancing both
+   positions by the number of bytes copied.  The data passes
+   through a page of kernel memory a page at a time.  The sectors
+   DST will need past its end are reserved up front, as one run if
+   possible, and each is written once, with its data.  Returns the
+   number of bytes copied, which may be less than SIZE if end of
+   SRC is reached, DST reaches the largest size a file can have,
+   or an error occurs, or -1 if an error occurs before any bytes
+   are copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  uint8_t *buffer;
+  off_t copied = 0;
+  off_t left = file_length (src) - src->pos;
+  bool reserved = false;
+
+  /* Clamp to what DST can hold first, so that the position plus
+     the size cannot overflow. */
+  if (dst->pos >= inode_max_length ())
+    return size > 0 && left > 0 ? -1 : 0;
+  if (size > inode_max_length () - dst->pos)
+    size = inode_max_length () - dst->pos;
+  if (size > left)
+    size = left;
+  if (size <= 0)
+    return 0;
+
+  buffer = palloc_get_page (0);
+  if (buffer == NULL)
+    return -1;
+
+  if (dst->pos + size > file_length (dst))
+    {
+      inode_reserve (dst->inode, dst->pos, size);
+      reserved = true;
+    }
+
+  while (copied < size)
+    {
+      off_t chunk = size - copied < PGSIZE ? size - copied : PGSIZE;
+      off_t bytes_read = file_read (src, buffer, chunk);
+      off_t bytes_written = file_write (dst, buffer, bytes_read);
+
+      copied += bytes_written;
+      if (bytes_written != chunk)
+        {
+          /* Leave SRC just past what made it into DST. */
+          src->pos -= bytes_read - bytes_written;
+          if (bytes_written < bytes_read && copied == 0)
+            copied = -1;
+          break;
+        }
+    }
+
+  if (reserved)
+    inode_unreserve (dst->inode);
+  palloc_free_page (buffer);
+  return copied;
+}
+
+/* Allocates disk space for the LENGTH bytes of FILE starting at
+   offset OFFSET, growing FILE to cover them if it is shorter.
+   Returns true if successful, false otherwise.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t offset, off_t length)
+{
+  return inode_allocate (file->inode, offset, length, true);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -1,10 +1,23 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/off_t.h"
 
 struct inode;
 
+/* Creating files. */
+struct inode *file_create (block_sector_t sector, off_t length);
+
+/* Number of sectors to read ahead of a sequential reader.
+   Controlled by kernel command-line option "-ra=SECTORS", and
+   at most FILE_READAHEAD_MAX, since the read-ahead queue holds
+   only one request per cache entry. */
+extern unsigned file_readahead_window;
+#define FILE_READAHEAD_MAX CACHE_CNT
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -16,6 +29,8 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+bool file_allocate (struct file *, off_t offset, off_t length);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
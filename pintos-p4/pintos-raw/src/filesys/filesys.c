@@ -2,8 +2,11 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "threads/thread.h"
@@ -23,9 +26,12 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
+  journal_init (format);
   if (format)
     do_format ();
 
@@ -37,7 +43,10 @@ to disk. */
 void
 filesys_done (void)
 {
+  inode_done ();
   free_map_close ();
+  journal_commit ();
+  cache_flush ();
 }
 
 /* Extracts a file name part from *SRCP into PART,
@@ -190,6 +199,10 @@ filesys_create (const char *name, off_t initial_size, enum inode_type type)
   char base_name[NAME_MAX + 1];
   bool resolved = resolve_name_to_entry(name, &dir, base_name); // return type?
   bool success = false;
+  struct inode *inode = NULL;
+
+  /* New inodes go just after their parent directory's. */
+  block_sector_t goal = dir != NULL ? inode_get_inumber(dir_get_inode(dir)) : 0;
 
   if (base_name == NULL || !strcmp(base_name, ""))
   {
@@ -208,16 +221,24 @@ filesys_create (const char *name, off_t initial_size, enum inode_type type)
     // printf("4. %d\n", dir_add(dir, base_name, inode_sector));
     success = (
       dir != NULL
-      && free_map_allocate(&inode_sector)
-      && file_create(inode_sector, initial_size)
+      && free_map_allocate_near(goal, &inode_sector)
+      && (inode = file_create(inode_sector, initial_size)) != NULL
       && dir_add(dir, base_name, inode_sector)
     );
+
+    /* A file that could not be linked in is removed, so that
+       closing it frees its sectors. */
+    if (inode != NULL && !success)
+    {
+      inode_remove(inode);
+    }
+    inode_close(inode);
   }
   else
   {
     success = (
       dir != NULL
-      && free_map_allocate(&inode_sector)
+      && free_map_allocate_near(goal, &inode_sector)
       && dir_create(inode_sector, inode_get_inumber(dir_get_inode(dir)))
       && dir_add(dir, base_name, inode_sector)
     );
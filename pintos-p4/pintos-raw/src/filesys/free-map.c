@@ -1,14 +1,134 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
+/* Sectors summarized by each entry in group_free. */
+#define GROUP_SECTORS 4096
+
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 static struct lock free_map_lock;
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t group_cnt;             /* Number of groups. */
+
+/* Sectors released with free_map_release_later() that may not be
+   reused until the next journal commit. */
+static struct bitmap *pending;
+static size_t pending_cnt;           /* Number of bits set in PENDING. */
+
+/* Bits of the free map held by each sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors of the free map file that the next journal commit must
+   log, because the free map has changed since the last one.  Only
+   these are logged, so the cost of a commit does not grow with the
+   size of the disk. */
+static struct bitmap *dirty;
+static size_t dirty_cnt;             /* Number of bits set in DIRTY. */
+
+/* Where each sector of the free map file lies on disk, or a null
+   pointer until the file has been created or opened.  The journal
+   writes those sectors directly, not through the file. */
+static block_sector_t *file_sectors;
+
+/* Returns the number of sectors in the free map file. */
+static size_t
+file_sector_cnt (void)
+{
+  return DIV_ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the number of sectors in group G. */
+static size_t
+group_size (size_t g)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  return end - g * GROUP_SECTORS;
+}
+
+/* Recounts the free sectors in every group. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    group_free[g] = bitmap_count (free_map, g * GROUP_SECTORS,
+                                  group_size (g), false);
+}
+
+/* Marks the CNT sectors starting at SECTOR as VALUE (true for
+   used) and updates the group counts to match. */
+static void
+set_run (size_t sector, size_t cnt, bool value)
+{
+  size_t s;
+
+  for (s = sector / BITS_PER_SECTOR;
+       cnt > 0 && s <= (sector + cnt - 1) / BITS_PER_SECTOR; s++)
+    if (!bitmap_test (dirty, s))
+      {
+        bitmap_mark (dirty, s);
+        dirty_cnt++;
+      }
+
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+      if (value)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors at or
+   after START, or BITMAP_ERROR if there is none.  Skips over
+   groups that have no free sectors without looking at their
+   bits. */
+static size_t
+search (size_t start, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector = start;
+
+  while (sector + cnt <= size)
+    {
+      size_t used;
+
+      if (group_free[sector / GROUP_SECTORS] == 0)
+        {
+          sector = (sector / GROUP_SECTORS + 1) * GROUP_SECTORS;
+          continue;
+        }
+
+      /* Find a free sector, then the end of its run. */
+      sector = bitmap_scan (free_map, sector, 1, false);
+      if (sector == BITMAP_ERROR || sector + cnt > size)
+        break;
+      used = bitmap_scan (free_map, sector, 1, true);
+      if (used == BITMAP_ERROR || used >= sector + cnt)
+        return sector;
+      sector = used + 1;
+    }
+  return BITMAP_ERROR;
+}
 
 /* Initializes the free map. */
 void
@@ -17,39 +137,177 @@ free_map_init (void)
   lock_init (&free_map_lock);
 
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  pending = bitmap_create (block_size (fs_device));
+  if (free_map == NULL || pending == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  pending_cnt = 0;
+  dirty = bitmap_create (file_sector_cnt ());
+  if (dirty == NULL)
+    PANIC ("free map dirty bitmap creation failed");
+  dirty_cnt = 0;
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTOR_CNT, true);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("free map group allocation failed");
+  count_groups ();
+}
+
+/* Allocates a run of consecutive sectors, preferably CNT long,
+  searching from GOAL toward the end of the disk and then from
+  the start.  If no run of CNT sectors is free, settles for the
+  longest run of CNT/2, CNT/4, ... sectors that is.  Stores the
+  first sector into *STARTP and the run's length into *GOTP.
+  Must be called with free_map_lock held.
+  Returns true if successful, false if the disk is full. */
+static bool
+allocate (size_t goal, size_t cnt, block_sector_t *startp, size_t *gotp)
+{
+  size_t sector = BITMAP_ERROR;
+
+  ASSERT (cnt > 0);
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  for (; cnt > 0; cnt /= 2)
+    {
+      sector = search (goal, cnt);
+      if (sector == BITMAP_ERROR && goal > 0)
+        sector = search (0, cnt);
+      if (sector != BITMAP_ERROR)
+        break;
+    }
+  if (sector == BITMAP_ERROR)
+    return false;
+
+  set_run (sector, cnt, true);
+  *startp = sector;
+  *gotp = cnt;
+  return true;
 }
 
-/* Allocates a sector from the free map and stores it into
-  *SECTORP.
-  Returns true if successful, false if not enough consecutive
-  sectors were available or if the free_map file could not be
-  written. */
+/* Allocates a sector as close after GOAL as possible and stores
+  it into *SECTORP.  Placing a file's inode just after its
+  directory's, and each of its blocks just after the one before,
+  keeps what is used together close together on disk, the way
+  FFS allocates within a cylinder group.  If GOAL's group is
+  full, the search moves on to the following groups.
+  Returns true if successful, false if the disk is full. */
 bool
-free_map_allocate (block_sector_t *sectorp)
+free_map_allocate_near (block_sector_t goal, block_sector_t *sectorp)
 {
-  size_t sector;
+  size_t got;
+
+  return free_map_allocate_run_near (goal, 1, sectorp, &got);
+}
+
+/* Allocates a run of consecutive sectors from the free map,
+  preferably CNT long, as close after GOAL as possible, as
+  free_map_allocate_near() does.  Stores the first sector into
+  *STARTP and the run's length into *GOTP.  If no run of CNT
+  sectors is free, settles for the longest run of CNT/2, CNT/4,
+  ... sectors that is.
+  Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_run_near (block_sector_t goal, size_t cnt,
+                            block_sector_t *startp, size_t *gotp)
+{
+  bool success;
 
   lock_acquire (&free_map_lock);
-  sector = bitmap_scan_and_flip (free_map, 0, 1, false);
+  success = allocate (goal, cnt, startp, gotp);
   lock_release (&free_map_lock);
 
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-
-  return sector != BITMAP_ERROR;
+  return success;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
+free_map_release_run (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  set_run (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use once the
+   next journal commit is complete.  For sectors that belonged to a
+   removed file: until the removal is on disk, a crash would bring
+   the file back, so its sectors must keep their contents. */
+void
+free_map_release_later (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  ASSERT (bitmap_none (pending, sector, cnt));
+  bitmap_set_multiple (pending, sector, cnt, true);
+  pending_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released with free_map_release_later()
+   available for use.  Called by the journal after a commit,
+   which has made durable every change that was complete when
+   they were released. */
+void
+free_map_release_pending (void)
+{
+  size_t sector = 0;
+
+  lock_acquire (&free_map_lock);
+  while (pending_cnt > 0)
+    {
+      size_t end;
+
+      sector = bitmap_scan (pending, sector, 1, true);
+      ASSERT (sector != BITMAP_ERROR);
+      end = bitmap_scan (pending, sector, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (pending);
+      bitmap_set_multiple (pending, sector, end - sector, false);
+      set_run (sector, end - sector, false);
+      pending_cnt -= end - sector;
+      sector = end;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Makes SECTOR available for use. */
+void
 free_map_release (block_sector_t sector)
 {
   lock_acquire (&free_map_lock);
   ASSERT (bitmap_test (free_map, sector));
-  bitmap_reset (free_map, sector);
+  set_run (sector, 1, false);
+  lock_release (&free_map_lock);
+}
+
+/* Looks up where each sector of the free map file lies on disk,
+   for free_map_collect(). */
+static void
+find_file_sectors (void)
+{
+  struct inode *inode = file_get_inode (free_map_file);
+  block_sector_t *sectors;
+  size_t i;
+
+  sectors = malloc (file_sector_cnt () * sizeof *sectors);
+  if (sectors == NULL)
+    PANIC ("free map sector list allocation failed");
+  for (i = 0; i < file_sector_cnt (); i++)
+    {
+      sectors[i] = inode_byte_to_sector (inode, i * BLOCK_SECTOR_SIZE);
+      if (sectors[i] == 0)
+        PANIC ("free map file is not laid out; reformat the disk");
+    }
+
+  lock_acquire (&free_map_lock);
+  free (file_sectors);
+  file_sectors = sectors;
   lock_release (&free_map_lock);
 }
 
@@ -63,41 +321,94 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  find_file_sectors ();
+  count_groups ();
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Returns the number of free sectors on the disk. */
+size_t
+free_map_free_cnt (void)
+{
+  size_t cnt = 0;
+  size_t g;
+
+  lock_acquire (&free_map_lock);
+  for (g = 0; g < group_cnt; g++)
+    cnt += group_free[g];
+  lock_release (&free_map_lock);
+
+  return cnt;
+}
+
+/* Copies up to MAX sectors of the free map file that have changed
+   since the last call into DATA, as they should now be on disk,
+   and stores where they belong into SECTORS.  They are written to
+   disk directly, so any cached copies of them are dropped.  Sets
+   *ALLP to true if no changed sectors are left.  Returns the
+   number of sectors copied.  Does nothing until the free map file
+   has been created or opened.  For the journal. */
+size_t
+free_map_collect (block_sector_t sectors[], void *data_, size_t max,
+                  bool *allp)
+{
+  uint8_t *data = data_;
+  size_t cnt = 0;
+  size_t s = 0;
+
+  lock_acquire (&free_map_lock);
+  if (file_sectors != NULL)
+    while (cnt < max && dirty_cnt > 0)
+      {
+        s = bitmap_scan (dirty, s, 1, true);
+        ASSERT (s != BITMAP_ERROR);
+        bitmap_reset (dirty, s);
+        dirty_cnt--;
+
+        sectors[cnt] = file_sectors[s];
+        bitmap_file_image (free_map, s * BLOCK_SECTOR_SIZE,
+                           data + cnt * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        cache_discard (file_sectors[s], 1);
+        cnt++;
+      }
+  *allp = file_sectors == NULL || dirty_cnt == 0;
+  lock_release (&free_map_lock);
+
+  return cnt;
+}
+
+/* Makes the free map durable with a journal commit and closes the
+   free map file.  Later commits still log changes to the free
+   map. */
 void
 free_map_close (void)
 {
-  if (!bitmap_write (free_map, free_map_file))
-    PANIC ("can't write free map");
-
+  journal_commit ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
-/* Creates a new free map file on disk and writes the free map to
-   it. */
+/* Creates a new free map file on disk.  The next journal commit
+   writes the free map to it. */
 void
 free_map_create (void) 
 {
   //printf("free map create\n");
   struct inode *inode;
 
-  /* Create inode. */
-  inode = file_create (FREE_MAP_SECTOR, 0);
+  /* Create inode.  The file is a whole number of sectors, so that
+     it never fits inline in its inode and each of its sectors has
+     a place of its own on disk, and it is laid out in full. */
+  inode = file_create (FREE_MAP_SECTOR,
+                       file_sector_cnt () * BLOCK_SECTOR_SIZE);
   if (inode == NULL)
     PANIC ("free map creation failed");
-  inode_close (inode);
-
-  //printf("created inode\n");
-
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  //printf("opened free map\n");
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
-    PANIC ("can't write free map");
+  find_file_sectors ();
 
-  //printf("wrote bitmap\n");
+  lock_acquire (&free_map_lock);
+  bitmap_set_all (dirty, true);
+  dirty_cnt = file_sector_cnt ();
+  lock_release (&free_map_lock);
 }
@@ -8,6 +8,14 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
-bool free_map_allocate (block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, block_sector_t *);
+bool free_map_allocate_run_near (block_sector_t goal, size_t cnt,
+                                 block_sector_t *, size_t *);
 void free_map_release (block_sector_t);
+void free_map_release_run (block_sector_t, size_t cnt);
+void free_map_release_later (block_sector_t, size_t cnt);
+void free_map_release_pending (void);
+size_t free_map_free_cnt (void);
+size_t free_map_collect (block_sector_t sectors[], void *data, size_t max,
+                         bool *allp);
 #endif /* filesys/free-map.h */
@@ -1,12 +1,19 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -21,12 +28,26 @@
 + PTRS_PER_SECTOR * PTRS_PER_SECTOR * DBL_INDIRECT_CNT) \
 * BLOCK_SECTOR_SIZE)
 
+/* Most bytes of data an inode can hold in its own sector. */
+#define INLINE_MAX (SECTOR_CNT * sizeof (block_sector_t))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A new inode keeps its data inline, in the space that otherwise
+   holds its sector pointers, so that a small file costs one
+   sector and reading it costs one sector read.  The first write
+   that would reach past INLINE_MAX bytes moves the data out to a
+   data sector, for good. */
 struct inode_disk
   {
-    block_sector_t sectors[SECTOR_CNT]; /* Sectors. */
-    enum inode_type type; /* FILE_INODE or DIR_INODE. */
+    union
+      {
+        block_sector_t sectors[SECTOR_CNT]; /* Sectors. */
+        uint8_t bytes[INLINE_MAX]; /* Data, if INLINE_DATA. */
+      };
+    uint8_t type; /* FILE_INODE or DIR_INODE. */
+    bool inline_data; /* Data in BYTES instead of SECTORS? */
+    uint16_t unused;
     off_t length; /* File size in bytes. */
     unsigned magic; /* Magic number. */
   };
@@ -39,20 +60,51 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* What the open_inodes table is keyed on, so that a lookup needs
+only one of these on the stack rather than a whole inode. */
+struct inode_key
+{
+  struct hash_elem elem; /* Element in open_inodes table. */
+  block_sector_t sector; /* Sector number of disk location. */
+};
+
 /* In-memory inode. */
 struct inode
 {
-  struct list_elem elem; /* Element in inode list. */
-  block_sector_t sector; /* Sector number of disk location. */
+  struct inode_key key; /* Element in open_inodes table, and sector. */
+  bool loading; /* Still being read in by its first opener? */
   int open_cnt; /* Number of openers. */
   bool removed; /* True if deleted, false otherwise. */
-  struct lock lock; /* Protects the inode. */
+  struct rwlock lock; /* Protects the inode's contents. */
+  struct lock grow_lock; /* Serializes allocation and growth. */
 
   /* Denying writes. */
   struct lock deny_write_lock; /* Protects members below. */
   struct condition no_writers_cond; /* Signaled when no writers. */
   int deny_write_cnt; /* 0: writes ok, >0: deny writes. */
   int writer_cnt; /* Number of writers. */
+
+  /* Resident copy of the on-disk inode.  Changes to DATA are made
+     with grow_lock held, inside a journal transaction that also
+     stores them into the inode's cached sector.  Readers may look
+     at the length and sector pointers without the lock, since a
+     pointer only changes from 0 to a sector that is already
+     zeroed and the length only grows after the data it covers is
+     written.  Inline data is the exception; see promote(). */
+  struct inode_disk data; /* Length, type and sector pointers. */
+
+  /* Sectors reserved by inode_write_at for blocks it is about to
+     allocate, so that an extending write gets a contiguous run.
+     Only used by the holder of grow_lock. */
+  block_sector_t reserve_start; /* First reserved sector. */
+  size_t reserve_cnt; /* Number of reserved sectors left. */
+  bool reserve_zeroed; /* Reserved sectors zeroed on disk? */
+  bool reserve_held; /* Kept across writes by inode_reserve()? */
+
+  /* Where to look for the next sector to allocate: just past the
+     last one allocated, or past the inode itself at first.  Only
+     used by the holder of grow_lock. */
+  block_sector_t alloc_goal;
   unsigned magic;
 };
 
@@ -70,20 +122,103 @@ struct inode
 //     return -1;
 // }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
 
-/* Controls access to open_inodes list. */
+/* Controls access to open_inodes and to each inode's open_cnt
+   and loading. */
 static struct lock open_inodes_lock;
 
+/* Signaled when an inode in open_inodes finishes loading. */
+static struct condition inode_loaded;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* A removed inode whose sectors are waiting to be freed. */
+struct reclaim
+  {
+    struct list_elem elem;      /* Element in reclaim_list. */
+    block_sector_t sector;      /* Inode's own sector. */
+    struct inode_disk data;     /* Inode's last contents. */
+  };
+
+/* Removed inodes are handed to the reclaim thread, so that the
+   last close of a large removed file does not wait for its whole
+   block tree to be walked and freed. */
+static struct list reclaim_list;        /* Waiting inodes. */
+static struct lock reclaim_lock;        /* Protects the members below. */
+static struct condition reclaim_cond;   /* Signaled when work arrives. */
+static struct condition reclaim_idle;   /* Signaled when work is done. */
+static bool reclaim_busy;               /* Reclaiming an inode now? */
+
 static void deallocate_inode (const struct inode *);
+static void reclaim_daemon (void *aux);
+
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
   lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  cond_init (&reclaim_cond);
+  cond_init (&reclaim_idle);
+  reclaim_busy = false;
+  thread_create ("reclaim", PRI_DEFAULT, reclaim_daemon, NULL);
+}
+
+/* Waits until the reclaim thread has handed the sectors of every
+   removed inode queued so far to the free map. */
+static void
+wait_for_reclaim (void)
+{
+  lock_acquire (&reclaim_lock);
+  while (!list_empty (&reclaim_list) || reclaim_busy)
+    cond_wait (&reclaim_idle, &reclaim_lock);
+  lock_release (&reclaim_lock);
+}
+
+/* Waits until the sectors of every removed inode have been freed,
+   so that the free map can be written out. */
+void
+inode_done (void)
+{
+  wait_for_reclaim ();
+}
+
+/* If fewer than CNT sectors are free, waits for the reclaim
+   thread to catch up and commits the journal, so that the sectors
+   of files removed just before become available.  Does nothing
+   inside a transaction, where committing would deadlock. */
+static void
+reclaim_space (size_t cnt)
+{
+  if (thread_current ()->journal_depth > 0 || free_map_free_cnt () >= cnt)
+    return;
+  wait_for_reclaim ();
+  journal_commit ();
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode_key, elem)->sector);
+}
+
+/* Returns true if the key containing A precedes the one
+   containing B in sector order. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode_key, elem)->sector
+          < hash_entry (b, struct inode_key, elem)->sector);
 }
 
 /* Initializes an inode of the given TYPE, writes the new inode
@@ -98,7 +233,13 @@ inode_create (block_sector_t sector, enum inode_type type)
 // ...
   //printf("inode create\n");
   
-  struct inode_disk *disk_inode = calloc(1, sizeof *disk_inode);
+  struct inode_disk *disk_inode;
+
+  /* If this assertion fails, the inode structure is not exactly
+     one sector in size, and you should fix that. */
+  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+
+  disk_inode = calloc(1, sizeof *disk_inode);
   if (disk_inode == NULL)
   {
     return NULL;
@@ -107,10 +248,15 @@ inode_create (block_sector_t sector, enum inode_type type)
   //printf("inode create 2\n");
   /* set inode type */
   disk_inode->type = type;
+  /* The journal writes the free map while a commit holds off
+     transactions, which writing inline data would need. */
+  disk_inode->inline_data = sector != FREE_MAP_SECTOR;
   disk_inode->magic = INODE_MAGIC;
 
-  /* write sector to disk */
-  block_write(fs_device, sector, disk_inode);
+  /* write sector through the buffer cache */
+  journal_begin ();
+  cache_write_meta(sector, disk_inode);
+  journal_end ();
   //printf("inode create 3\n");
 
   /* free disk inode? */
@@ -167,49 +313,63 @@ Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  // printf("inode open! %d\n", sector);
-  //printf("inode open\n");
-// Don't forget to access open_inodes list
-  struct list_elem *e;
+  struct inode_key key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open.  If it is still
+     being read in, wait for that to finish. */
+  key.sector = sector;
+  lock_acquire(&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
   {
-    //printf("iterating\n");
-    inode = list_entry (e, struct inode, elem);
-    if (inode->sector == sector) 
-    {
-      //printf("?\n");
-      inode_reopen (inode);
-      return inode; 
-    }
+    inode = hash_entry (e, struct inode, key.elem);
+    inode->open_cnt++;
+    while (inode->loading)
+      cond_wait (&inode_loaded, &open_inodes_lock);
+    lock_release(&open_inodes_lock);
+    return inode;
   }
 
-  //printf("inode isn't already open\n");
-
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
+  {
+    lock_release(&open_inodes_lock);
     return NULL;
+  }
 
   //printf("initializing inode\n");
   /* initialize */
-  inode->sector = sector;
+  inode->key.sector = sector;
   inode->open_cnt = 1;
   inode->removed = false;
-  lock_init(&inode->lock);
+  rw_init(&inode->lock);
+  lock_init(&inode->grow_lock);
   lock_init(&inode->deny_write_lock);
   cond_init(&inode->no_writers_cond);
   inode->deny_write_cnt = 0;
   inode->writer_cnt = 0;
+  inode->reserve_cnt = 0;
+  inode->reserve_zeroed = false;
+  inode->reserve_held = false;
+  inode->alloc_goal = sector + 1;
   inode->magic = INODE_MAGIC;
 
-  //printf("adding to open inodes list\n");
-  /* add to open inodes list */
+  /* Add it to the open inodes table marked as loading, so that
+     other openers of the same sector find it and wait, and read
+     it in with the table unlocked, so that openers of other
+     inodes do not wait for the disk. */
+  inode->loading = true;
+  hash_insert (&open_inodes, &inode->key.elem);
+  lock_release(&open_inodes_lock);
+
+  cache_read(sector, &inode->data);
+
   lock_acquire(&open_inodes_lock);
-  list_push_front (&open_inodes, &inode->elem);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
   lock_release(&open_inodes_lock);
 
   return inode;
@@ -275,17 +435,27 @@ enum inode_type
 inode_get_type (const struct inode *inode)
 {
   ASSERT(inode != NULL);
+  return inode->data.type;
+}
 
-  struct inode_disk disk_inode;
-  block_read(fs_device, inode->sector, &disk_inode);
-  return disk_inode.type;
+/* Returns the type of the inode in SECTOR, which need not be
+open.  An inode's type never changes, so the copy in the buffer
+cache is always current. */
+enum inode_type
+inode_get_type_at (block_sector_t sector)
+{
+  uint8_t type;
+
+  cache_read_at (sector, &type, offsetof (struct inode_disk, type),
+                 sizeof type);
+  return type;
 }
 
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
 {
-  return inode->sector;
+  return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
@@ -298,40 +468,147 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  Every change
+     to the inode is already in its cached sector, so a following
+     inode_open() of the same sector reads the latest version. */
+  lock_acquire(&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      lock_acquire(&open_inodes_lock);
-      list_remove (&inode->elem);
       lock_release(&open_inodes_lock);
+      return;
+    }
+  hash_delete (&open_inodes, &inode->key.elem);
+  lock_release(&open_inodes_lock);
+
+  /* deallocate inode and free */
+  if (inode->removed)
+    deallocate_inode(inode);
+  free (inode); 
+}
 
-      /* if removed, we want to get rid of data */
+/* Most sectors released to the free map at once. */
+#define RELEASE_MAX 64
 
-      /* deallocate inode and free */
-      deallocate_inode(inode);
-      free (inode); 
-    }
+/* A run of consecutive sectors waiting to be released together,
+so that freeing a contiguous file takes one free map update per
+run instead of one per sector.  The free map holds them back
+from reuse until the removal of their file is committed. */
+struct release_batch
+{
+  block_sector_t start; /* First sector of the run. */
+  size_t cnt; /* Number of sectors in the run. */
+};
+
+/* Releases the sectors in BATCH to the free map and empties it. */
+static void
+release_flush (struct release_batch *batch)
+{
+  if (batch->cnt > 0)
+  {
+    free_map_release_later (batch->start, batch->cnt);
+    batch->cnt = 0;
+  }
+}
+
+/* Adds SECTOR to BATCH, first releasing what BATCH holds if SECTOR
+does not extend its run. */
+static void
+release_add (struct release_batch *batch, block_sector_t sector)
+{
+  if (batch->cnt > 0
+      && (sector != batch->start + batch->cnt || batch->cnt >= RELEASE_MAX))
+    release_flush (batch);
+  if (batch->cnt == 0)
+    batch->start = sector;
+  batch->cnt++;
 }
 
 /* Deallocates SECTOR and anything it points to recursively.
 LEVEL is 2 if SECTOR is doubly indirect,
 or 1 if SECTOR is indirect,
-or 0 if SECTOR is a data sector. */
+or 0 if SECTOR is a data sector.
+Only the reclaim thread calls this, so one index buffer per level
+is enough. */
 static void
-deallocate_recursive (block_sector_t sector, int level)
+deallocate_recursive (block_sector_t sector, int level,
+                      struct release_batch *batch)
 {
-// deallocate_recursive, .....
-  // printf("deallocate recursive not implemented\n");
+  static block_sector_t index[2][PTRS_PER_SECTOR];
+
+  if (sector == 0)
+    return;
+
+  if (level > 0)
+  {
+    block_sector_t *ptrs = index[level - 1];
+    off_t i;
+
+    cache_read (sector, ptrs);
+    for (i = 0; i < PTRS_PER_SECTOR; i++)
+      deallocate_recursive (ptrs[i], level - 1, batch);
+  }
+  release_add (batch, sector);
 }
 
-/* Deallocates the blocks allocated for INODE. */
+/* Hands INODE, which has been removed and closed for the last
+time, to the reclaim thread to free its sectors. */
 static void
 deallocate_inode (const struct inode *inode)
 {
-// NOTE: you should call deallocate recursive here to
-// recursively iterate each level of indirection ..
-  //printf("Deallocate inode not implemented\n");
+  struct reclaim *r = malloc (sizeof *r);
+
+  /* Out of memory: the sectors leak, but the disk stays
+     consistent. */
+  if (r == NULL)
+    return;
+
+  r->sector = inode->key.sector;
+  r->data = inode->data;
+  lock_acquire (&reclaim_lock);
+  list_push_back (&reclaim_list, &r->elem);
+  cond_signal (&reclaim_cond, &reclaim_lock);
+  lock_release (&reclaim_lock);
+}
+
+/* Reclaim thread.  Frees the data, index and inode sectors of
+removed inodes, in runs. */
+static void
+reclaim_daemon (void *aux UNUSED)
+{
+  for (;;)
+  {
+    struct release_batch batch = { 0, 0 };
+    struct reclaim *r;
+    size_t i;
+
+    lock_acquire (&reclaim_lock);
+    reclaim_busy = false;
+    cond_broadcast (&reclaim_idle, &reclaim_lock);
+    while (list_empty (&reclaim_list))
+      cond_wait (&reclaim_cond, &reclaim_lock);
+    r = list_entry (list_pop_front (&reclaim_list), struct reclaim, elem);
+    reclaim_busy = true;
+    lock_release (&reclaim_lock);
+
+    if (!r->data.inline_data)
+    {
+      for (i = 0; i < DIRECT_CNT; i++)
+        deallocate_recursive (r->data.sectors[i], 0, &batch);
+      deallocate_recursive (r->data.sectors[DIRECT_CNT], 1, &batch);
+      deallocate_recursive (r->data.sectors[DIRECT_CNT + INDIRECT_CNT], 2,
+                            &batch);
+    }
+    release_add (&batch, r->sector);
+    release_flush (&batch);
+
+    /* Names may have been cached under a removed directory until
+       its last close, by a process using it as its working
+       directory.  They must not turn up in the next directory to
+       get its sector. */
+    if (r->data.type == DIR_INODE)
+      dcache_invalidate_dir (r->sector);
+    free (r);
+  }
 }
 
 
@@ -377,82 +654,215 @@ calculate_indices (off_t sector_idx, size_t offsets[], size_t *offset_cnt)
   //printf("calculated indices\n");
 }
 
-/* Retrieves the data block for the given byte OFFSET in INODE,
-setting *DATA_BLOCK to the block and data_sector to the sector to write
-(for inode_write_at method).
+/* Returns true if INODE's data is file system metadata, which
+goes through the journal: a directory, or the free map. */
+static bool
+is_meta (const struct inode *inode)
+{
+  return inode->data.type == DIR_INODE || inode->key.sector == FREE_MAP_SECTOR;
+}
+
+/* Stores INODE's resident on-disk inode into its cached sector.
+Must be called with INODE's grow_lock held, inside a journal
+transaction. */
+static void
+store_inode (struct inode *inode)
+{
+  cache_write_meta (inode->key.sector, &inode->data);
+}
+
+/* Returns true if INODE's data is inline.  The answer can only
+change from true to false, under grow_lock, so a false answer
+may be relied upon without the lock. */
+static bool
+is_inline (const struct inode *inode)
+{
+  return inode->data.inline_data;
+}
+
+static bool allocate_sector (struct inode *, block_sector_t *, bool *);
+
+/* Moves INODE's inline data out to a sector of its own, which
+becomes the file's first data sector, so that the file can grow
+past INLINE_MAX bytes.  The data is journaled on its way out,
+since until now it was metadata.  Must be called with INODE's
+grow_lock held.
+Returns true if successful, false if the disk is full. */
+static bool
+promote (struct inode *inode)
+{
+  uint8_t *block;
+  block_sector_t sector = 0;
+
+  block = calloc (1, BLOCK_SECTOR_SIZE);
+  if (block == NULL)
+    return false;
+
+  journal_begin ();
+  if (inode->data.length > 0)
+  {
+    if (!allocate_sector (inode, &sector, NULL))
+    {
+      journal_end ();
+      free (block);
+      return false;
+    }
+    memcpy (block, inode->data.bytes, inode->data.length);
+    cache_write_meta (sector, block);
+  }
+
+  /* Clear the flag last: a reader that finds it clear may walk
+     the sector pointers without the lock. */
+  memset (inode->data.sectors, 0, sizeof inode->data.sectors);
+  inode->data.sectors[0] = sector;
+  barrier ();
+  inode->data.inline_data = false;
+  store_inode (inode);
+  journal_end ();
+
+  free (block);
+  return true;
+}
+
+/* Allocates a sector for INODE into *SECTORP, taking it from the
+run reserved by inode_write_at if there is one, or else as close
+after INODE's previous allocation as possible.  If ZEROEDP is
+nonnull, sets *ZEROEDP to true if the sector is already zeroed on
+disk, false otherwise.
+Returns true if successful, false if the disk is full. */
+static bool
+allocate_sector (struct inode *inode, block_sector_t *sectorp,
+                 bool *zeroedp)
+{
+  bool zeroed = false;
+
+  if (inode->reserve_cnt > 0)
+  {
+    *sectorp = inode->reserve_start++;
+    inode->reserve_cnt--;
+    zeroed = inode->reserve_zeroed;
+  }
+  else if (!free_map_allocate_near (inode->alloc_goal, sectorp))
+    return false;
+  inode->alloc_goal = *sectorp + 1;
+  if (zeroedp != NULL)
+    *zeroedp = zeroed;
+  return true;
+}
+
+/* Retrieves the data sector for the given byte OFFSET in INODE,
+setting *DATA_SECTOR to the sector that holds it.
 Returns true if successful, false on failure.
 If ALLOCATE is false (usually for inode read), then missing blocks
-will be successful with *DATA_BLOCK set to a null pointer.
+will be successful with *DATA_SECTOR set to 0.
 If ALLOCATE is true (for inode write), then missing blocks will be allocated.
-This method may be called in parallel */
+A newly allocated data sector starts out as the BLOCK_SECTOR_SIZE
+bytes at FILL, if FILL is nonnull, and *FILLEDP is set to true;
+otherwise it starts out zeroed.  A writer that is about to
+overwrite the whole sector passes its data as FILL, so the sector
+is initialized once, before it is linked in, instead of being
+zeroed and then overwritten.
+Only the one pointer needed at each level is read, through the
+buffer cache, so walking the index costs no disk I/O once the
+inode and indirect sectors are cached.
+This method may be called in parallel: missing blocks are
+allocated with INODE's grow_lock held. */
 static bool
 get_data_block (struct inode *inode, off_t offset, bool allocate,
-void **data_block, block_sector_t *data_sector)
+const void *fill, block_sector_t *data_sector, bool *filledp)
 {
-  // printf("get data block\n");
   size_t offsets[3];
   size_t offset_cnt;
-  off_t sector_idx = offset / BLOCK_SECTOR_SIZE; // TODO is this right?
-  uint32_t *buffer = calloc(1, BLOCK_SECTOR_SIZE);
+  off_t sector_idx = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t sector = inode->key.sector;
+  size_t i;
 
+  ASSERT (!is_inline (inode));
   calculate_indices(sector_idx, offsets, &offset_cnt);
-  // printf("offset count %d\n", offset_cnt);
 
-  block_sector_t sector = inode->sector;
-  for (int i = 0; i < offset_cnt; i++)
+  for (i = 0; i < offset_cnt; i++)
   {
-    // printf("in loop i:%d\n", i);
-    block_read(fs_device, sector, buffer);
-    // block_sector_t next_sector = ((block_sector_t *) buffer)[offsets[i]];
-
-    // printf("read block and got next sector\n");
-    // printf("next sector: %d\n", next_sector);
-    // printf("allocate?: %d\n", allocate);
+    block_sector_t next;
+    off_t ptr_ofs = offsets[i] * sizeof next;
 
-    if (buffer[offsets[i]] == 0) // is this the right check?
+    /* The first level lives in the resident inode. */
+    if (i == 0)
+      next = inode->data.sectors[offsets[0]];
+    else
+      cache_read_at(sector, &next, ptr_ofs, sizeof next);
+    if (next == 0)
     {
+      static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+      bool held;
+
       if (!allocate)
       {
-        *data_block = NULL;
         *data_sector = 0;
-        free(buffer);
-        return true; //?
+        return true;
       }
 
-      //printf("free map allocation\n");
-      if (!free_map_allocate(&buffer[offsets[i]]))
+      /* An extending write already holds grow_lock.  Otherwise
+         take it, and look again in case another writer linked in
+         a block while we waited. */
+      held = lock_held_by_current_thread (&inode->grow_lock);
+      if (!held)
       {
-        free(buffer);
-        // allocation of a new sector failed
-        return false; 
+        lock_acquire (&inode->grow_lock);
+        if (i == 0)
+          next = inode->data.sectors[offsets[0]];
+        else
+          cache_read_at(sector, &next, ptr_ofs, sizeof next);
       }
 
-      // printf("Here\n");
-
-      //printf("new sector: %d\n", next_sector);
-      // allocate new device with zeros
-      char *zeros = calloc(1, BLOCK_SECTOR_SIZE);
-      block_write(fs_device, buffer[offsets[i]], zeros);
-      free(zeros);
-
-      // printf("block wrote\n");
+      if (next == 0)
+      {
+        /* Allocating and linking in the block is one
+           transaction, so that a crash cannot leave the block
+           both linked and free, or allocated and unlinked. */
+        bool zeroed;
+
+        journal_begin ();
+        if (!allocate_sector(inode, &next, &zeroed))
+        {
+          // allocation of a new sector failed
+          journal_end ();
+          if (!held)
+            lock_release (&inode->grow_lock);
+          return false;
+        }
+
+        // new sectors are initialized, then get linked in;
+        // index blocks and metadata inodes' data are metadata;
+        // a data sector that inode_allocate zeroed on disk is
+        // initialized already
+        const void *init = zeros;
+        if (i + 1 == offset_cnt && fill != NULL)
+        {
+          init = fill;
+          *filledp = true;
+        }
+        if (i + 1 < offset_cnt || is_meta (inode))
+          cache_write_meta(next, init);
+        else if (init != zeros || !zeroed)
+          cache_write(next, init);
+        if (i == 0)
+        {
+          inode->data.sectors[offsets[0]] = next;
+          store_inode (inode);
+        }
+        else
+          cache_write_at_meta(sector, &next, ptr_ofs, sizeof next);
+        journal_end ();
+      }
 
-      // update current sector with allocated block
-      // ((block_sector_t *) buffer)[offsets[i]] = next_sector;
-      block_write(fs_device, sector, buffer);
+      if (!held)
+        lock_release (&inode->grow_lock);
     }
 
-    sector = buffer[offsets[i]];
+    sector = next;
   }
 
-  // printf("Sector of data %d\n", sector);
-
-  // read data block and set data
-  //printf("finished loop\n");
-  block_read(fs_device, sector, buffer);
-  *data_block = buffer;
   *data_sector = sector;
-
   return true;
 
 /* NOTE: calculate_indices ... then access the sectors in the sequence
@@ -466,6 +876,19 @@ handled
 * bitmap/freemap (space manager) to allocate free sector for you */
 }
 
+/* Returns the sector that holds byte OFFSET of INODE, or 0 if
+INODE's data is inline or OFFSET lies in a hole. */
+block_sector_t
+inode_byte_to_sector (struct inode *inode, off_t offset)
+{
+  block_sector_t sector;
+
+  if (is_inline (inode)
+      || !get_data_block (inode, offset, false, NULL, &sector, NULL))
+    return 0;
+  return sector;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
 Returns the number of bytes actually read, which may be less
 than SIZE if an error occurs or end of file is reached.
@@ -475,50 +898,89 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  block_sector_t target_sector = 0; // not really useful for inode_read
+  block_sector_t target_sector = 0;
+
+  /* Inline data may only be read under grow_lock, since promote()
+     overwrites it with sector pointers. */
+  if (is_inline (inode))
+  {
+    lock_acquire (&inode->grow_lock);
+    if (is_inline (inode))
+    {
+      if (offset < inode->data.length)
+      {
+        bytes_read = inode->data.length - offset;
+        if (bytes_read > size)
+          bytes_read = size;
+        memcpy (buffer, inode->data.bytes + offset, bytes_read);
+      }
+      lock_release (&inode->grow_lock);
+      return bytes_read;
+    }
+    lock_release (&inode->grow_lock);
+  }
+
   while (size > 0)
   {
-    /* Sector to read, starting byte offset within sector, sector data. */
+    /* Starting byte offset within sector. */
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-    void *block; // NOTE: may need to be allocated in get_data_block method,
-    // and don't forget to free it in the end
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
     off_t inode_left = inode_length (inode) - offset;
     int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
     int min_left = inode_left < sector_left ? inode_left : sector_left;
     /* Number of bytes to actually copy out of this sector. */
     int chunk_size = size < min_left ? size : min_left;
-    if (chunk_size <= 0 || !get_data_block (inode, offset, false, &block, &target_sector)) {
+    if (chunk_size <= 0
+        || !get_data_block (inode, offset, false, NULL, &target_sector, NULL)) {
       break;
     }
 
-    if (block == NULL)
+    if (target_sector == 0)
       memset (buffer + bytes_read, 0, chunk_size);
     else
-    {
-      memcpy (buffer + bytes_read, block + sector_ofs, chunk_size);
-    }
+      cache_read_at (target_sector, buffer + bytes_read, sector_ofs,
+                     chunk_size);
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_read += chunk_size;
-    free(block); // NOTE: if needed?
   }
-  // printf("Reading bytes %zu, offset %zu\n", bytes_read, offset);
   return bytes_read;
 }
 
+/* Queues the sectors of INODE that hold the SIZE bytes starting
+   at OFFSET for asynchronous reading into the buffer cache.
+   Holes and bytes past end of file are skipped. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  block_sector_t sector;
+
+  /* Inline data was read along with the inode. */
+  if (is_inline (inode))
+    return;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+
+  offset -= offset % BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    if (get_data_block (inode, offset, false, NULL, &sector, NULL)
+        && sector != 0)
+      cache_readahead (sector);
+}
+
 /* Extends INODE to be at least LENGTH bytes long. */
 static void
 extend_file (struct inode *inode, off_t length)
 {
-  struct inode_disk *disk_inode = calloc (1, sizeof *disk_inode);
-  block_read(fs_device, inode->sector, disk_inode);
-  if (disk_inode->length < length) {
-    disk_inode->length = length;
+  if (inode->data.length < length) {
+    journal_begin ();
+    inode->data.length = length;
+    store_inode (inode);
+    journal_end ();
   }
-  block_write(fs_device, inode->sector, disk_inode);
-  free(disk_inode);
 
   /*ASSERT(inode != NULL);
 
@@ -529,7 +991,7 @@ extend_file (struct inode *inode, off_t length)
 
   // read disk inode
   struct inode_disk disk_inode;
-  block_read(fs_device, inode->sector, &disk_inode);
+  block_read(fs_device, inode->key.sector, &disk_inode);
 
   size_t needed_sectors = bytes_to_sectors(length);
   size_t current_sectors = bytes_to_sectors(disk_inode.length);
@@ -552,10 +1014,236 @@ extend_file (struct inode *inode, off_t length)
   }
 
   disk_inode.length = length;
-  block_write(fs_device, inode->sector, &disk_inode);
+  block_write(fs_device, inode->key.sector, &disk_inode);
   return true;*/
 }
 
+/* Registers the current thread as a writer of INODE, so that
+inode_deny_write() waits for it.  Returns false, without
+registering, if writes to INODE are denied. */
+static bool
+begin_write (struct inode *inode)
+{
+  bool ok;
+
+  lock_acquire (&inode->deny_write_lock);
+  ok = inode->deny_write_cnt == 0;
+  if (ok)
+    inode->writer_cnt++;
+  lock_release (&inode->deny_write_lock);
+  return ok;
+}
+
+/* Ends a write to INODE started with begin_write(). */
+static void
+end_write (struct inode *inode)
+{
+  lock_acquire (&inode->deny_write_lock);
+  if (--inode->writer_cnt == 0)
+    cond_signal (&inode->no_writers_cond, &inode->deny_write_lock);
+  lock_release (&inode->deny_write_lock);
+}
+
+/* Returns the number of index sectors needed to point to INODE's
+data sectors FIRST through LAST - 1, not counting the indirect
+and doubly indirect sectors if INODE has them already.  A
+second-level sector that already exists may be counted. */
+static size_t
+index_sectors (const struct inode *inode, size_t first, size_t last)
+{
+  size_t ind_first = DIRECT_CNT;
+  size_t dbl_first = DIRECT_CNT + PTRS_PER_SECTOR * INDIRECT_CNT;
+  size_t cnt = 0;
+
+  if (first < dbl_first && last > ind_first
+      && inode->data.sectors[DIRECT_CNT] == 0)
+    cnt++;
+  if (last > dbl_first)
+  {
+    size_t lo = (first > dbl_first ? first : dbl_first) - dbl_first;
+    size_t hi = last - dbl_first;
+
+    if (inode->data.sectors[DIRECT_CNT + INDIRECT_CNT] == 0)
+      cnt++;
+    cnt += (hi - 1) / PTRS_PER_SECTOR - lo / PTRS_PER_SECTOR + 1;
+  }
+  return cnt;
+}
+
+/* Reserves a contiguous run for the sectors of INODE that hold
+bytes OFFSET through END - 1 and lie past its current end of
+file, and for the index sectors that will point to them, for
+allocate_sector() to hand out.  Must be called with INODE's
+grow_lock held, and followed by release_reserved().  Does nothing
+while inode_reserve() holds a reservation. */
+static void
+reserve_sectors (struct inode *inode, off_t offset, off_t end)
+{
+  size_t first = bytes_to_sectors (inode_length (inode));
+  size_t last = bytes_to_sectors (end);
+
+  if (inode->reserve_held)
+    return;
+  if (first < (size_t) offset / BLOCK_SECTOR_SIZE)
+    first = offset / BLOCK_SECTOR_SIZE;
+  inode->reserve_zeroed = false;
+  inode->reserve_cnt = 0;
+  if (last > first)
+  {
+    size_t cnt = last - first + index_sectors (inode, first, last);
+
+    reclaim_space (cnt);
+    if (!free_map_allocate_run_near (inode->alloc_goal, cnt,
+                                     &inode->reserve_start,
+                                     &inode->reserve_cnt))
+      inode->reserve_cnt = 0;
+  }
+}
+
+/* Most sectors zero_reserved() writes with one disk command. */
+#define ZERO_BATCH 64
+
+/* Zeroes INODE's reserved sectors on disk, ZERO_BATCH at a time,
+and drops any stale cached copies, so that they can become data
+sectors without going through the buffer cache one by one.  Does
+nothing if memory is short. */
+static void
+zero_reserved (struct inode *inode)
+{
+  size_t page_cnt = ZERO_BATCH * BLOCK_SECTOR_SIZE / PGSIZE;
+  uint8_t *zeros;
+  size_t done;
+
+  if (inode->reserve_cnt == 0)
+    return;
+  zeros = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (zeros == NULL)
+    return;
+
+  for (done = 0; done < inode->reserve_cnt; done += ZERO_BATCH)
+  {
+    size_t cnt = inode->reserve_cnt - done;
+    if (cnt > ZERO_BATCH)
+      cnt = ZERO_BATCH;
+    block_write_multi (fs_device, inode->reserve_start + done, zeros, cnt);
+  }
+  cache_discard (inode->reserve_start, inode->reserve_cnt);
+  inode->reserve_zeroed = true;
+
+  palloc_free_multiple (zeros, page_cnt);
+}
+
+/* Gives back whatever part of INODE's reservation went unused,
+unless inode_reserve() holds it. */
+static void
+release_reserved (struct inode *inode)
+{
+  if (inode->reserve_cnt > 0 && !inode->reserve_held)
+  {
+    free_map_release_run (inode->reserve_start, inode->reserve_cnt);
+    inode->reserve_cnt = 0;
+  }
+}
+
+/* Allocates the sectors that hold the LENGTH bytes of INODE
+starting at OFFSET, along with the index sectors that point to
+them, and extends INODE to cover them if it is shorter and EXTEND
+is true.  New sectors read as zeros.  Sectors past end of file come from one
+contiguous run if the free map has one, so that a file whose size
+is known in advance is laid out in order, its index is built
+once instead of a sector at a time as it is written, and its
+data sectors are zeroed with a few multi-sector writes.
+Returns true if successful, false if writes to INODE are denied,
+the range is out of bounds, or the disk filled up, in which case
+some of the sectors may have been allocated anyway. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t length,
+                bool extend)
+{
+  off_t end;
+  bool success = true;
+
+  if (offset < 0 || length < 0 || offset > INODE_SPAN
+      || length > INODE_SPAN - offset)
+    return false;
+  end = offset + length;
+  if (length == 0)
+    return true;
+  if (!begin_write (inode))
+    return false;
+
+  lock_acquire (&inode->grow_lock);
+  if (is_inline (inode) && end > (off_t) INLINE_MAX)
+    success = promote (inode);
+  if (success && !is_inline (inode))
+  {
+    block_sector_t sector;
+    off_t pos;
+
+    reserve_sectors (inode, offset, end);
+    if (!is_meta (inode))
+      zero_reserved (inode);
+    for (pos = offset - offset % BLOCK_SECTOR_SIZE; pos < end;
+         pos += BLOCK_SECTOR_SIZE)
+      if (!get_data_block (inode, pos, true, NULL, &sector, NULL))
+      {
+        success = false;
+        break;
+      }
+    release_reserved (inode);
+  }
+  if (success && extend)
+    extend_file (inode, end);
+  lock_release (&inode->grow_lock);
+
+  end_write (inode);
+  return success;
+}
+
+/* Reserves a contiguous run for the sectors that writes extending
+INODE over the LENGTH bytes starting at OFFSET will need, as
+inode_write_at() does for a single write, but keeps it across
+writes until inode_unreserve().  Unlike inode_allocate(), it
+neither zeroes nor links in the sectors: each is initialized once,
+by the write that first uses it.  For a caller about to fill the
+range with a series of writes. */
+void
+inode_reserve (struct inode *inode, off_t offset, off_t length)
+{
+  if (offset < 0 || length <= 0 || offset > INODE_SPAN
+      || length > INODE_SPAN - offset)
+    return;
+
+  lock_acquire (&inode->grow_lock);
+  if (!is_inline (inode) && !inode->reserve_held)
+  {
+    reserve_sectors (inode, offset, offset + length);
+    inode->reserve_held = true;
+  }
+  lock_release (&inode->grow_lock);
+}
+
+/* Gives back whatever part of the run reserved by inode_reserve()
+went unused. */
+void
+inode_unreserve (struct inode *inode)
+{
+  lock_acquire (&inode->grow_lock);
+  if (inode->reserve_held)
+  {
+    inode->reserve_held = false;
+    release_reserved (inode);
+  }
+  lock_release (&inode->grow_lock);
+}
+
+/* Returns the largest number of bytes an inode can hold. */
+off_t
+inode_max_length (void)
+{
+  return INODE_SPAN;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
 Returns the number of bytes actually written, which may be
 less than SIZE if an error occurs.
@@ -570,49 +1258,86 @@ off_t offset)
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   block_sector_t target_sector = 0;
+  bool extending, locked;
   /* Don't write if writes are denied. */
-  lock_acquire (&inode->deny_write_lock);
-  if (inode->deny_write_cnt)
-  {
-    lock_release (&inode->deny_write_lock);
+  if (!begin_write (inode))
     return 0;
+
+  /* A write past end of file holds grow_lock throughout, so that
+     extending writers to one inode take turns and the length
+     never covers bytes that have not been written yet.  So does
+     a write to inline data.  Other writes within the file run in
+     parallel with each other and with readers. */
+  extending = size > 0 && offset + size > inode_length (inode);
+  locked = extending || is_inline (inode);
+  if (locked)
+    lock_acquire (&inode->grow_lock);
+
+  if (is_inline (inode))
+  {
+    if (offset + size <= (off_t) INLINE_MAX)
+    {
+      /* Write the data into the inode itself. */
+      journal_begin ();
+      memcpy (inode->data.bytes + offset, buffer, size);
+      if (inode->data.length < offset + size)
+        inode->data.length = offset + size;
+      store_inode (inode);
+      journal_end ();
+      bytes_written = size;
+      offset += size;
+      size = 0;
+    }
+    else if (!promote (inode))
+      size = 0;
   }
-  inode->writer_cnt++;
-  lock_release (&inode->deny_write_lock);
+
+  /* Reserve a contiguous run for the sectors this write adds
+     past the current end of file. */
+  if (extending && size > 0)
+    reserve_sectors (inode, offset, offset + size);
 
   //printf("inode write at 2\n");
   while (size > 0)
   {
       //printf("size > 0: %d\n", size);
-    /* Sector to write, starting byte offset within sector, sector data. */
+    /* Starting byte offset within sector. */
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-    void *block; // may need to be allocated in get_data_block method,
-    // and don't forget to free it in the end
     /* Bytes to max inode size, bytes left in sector, lesser of the two. */
     off_t inode_left = INODE_SPAN - offset;
     int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
     int min_left = inode_left < sector_left ? inode_left : sector_left;
     /* Number of bytes to actually write into this sector. */
     int chunk_size = size < min_left ? size : min_left;
-    if (chunk_size <= 0 || !get_data_block (inode, offset, true, &block,
-    &target_sector))
+    /* A whole sector's worth of data can initialize a new sector
+       directly. */
+    const void *fill = (chunk_size == BLOCK_SECTOR_SIZE
+                        ? buffer + bytes_written : NULL);
+    bool filled = false;
+    if (chunk_size <= 0 || !get_data_block (inode, offset, true, fill,
+    &target_sector, &filled))
       break;
-    //printf("got data block\n");
-    memcpy (block + sector_ofs, buffer + bytes_written, chunk_size);
-    block_write(fs_device, target_sector, block);
+    if (filled)
+      ; /* Already holds the data. */
+    else if (is_meta (inode))
+      cache_write_at_meta (target_sector, buffer + bytes_written, sector_ofs,
+                           chunk_size);
+    else
+      cache_write_at (target_sector, buffer + bytes_written, sector_ofs,
+                      chunk_size);
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_written += chunk_size;
-    free(block); // NOTE: if needed?
   }
 
-  //printf("inode write at 3\n");
-  extend_file (inode, offset);
-  lock_acquire (&inode->deny_write_lock);
-  if (--inode->writer_cnt == 0)
-    cond_signal (&inode->no_writers_cond, &inode->deny_write_lock);
-  lock_release (&inode->deny_write_lock);
+  release_reserved (inode);
+
+  if (extending)
+    extend_file (inode, offset);
+  if (locked)
+    lock_release (&inode->grow_lock);
+  end_write (inode);
   return bytes_written;
 }
 
@@ -657,12 +1382,7 @@ inode_length (const struct inode *inode)
   //printf("inode magic, %d\n", inode->magic == INODE_MAGIC);
   //printf("\n");
 
-  struct inode_disk *disk_inode = calloc(1, sizeof *disk_inode);
-  block_read(fs_device, inode->sector, disk_inode);
-  off_t length = disk_inode->length;
-  free(disk_inode);
-  return length;
-  
+  return inode->data.length;
 }
 
 /* Returns the number of openers. */
@@ -678,18 +1398,34 @@ inode_open_cnt (const struct inode *inode)
   return open_cnt;
 }
 
-/* Locks INODE. */
+/* Locks INODE for exclusive use, as when changing a directory. */
 void
 inode_lock (struct inode *inode)
 {
-  lock_acquire (&inode->lock);
+  rw_write_acquire (&inode->lock);
 }
 
-/* Releases INODE's lock. */
+/* Releases INODE's lock, taken with inode_lock(). */
 void
 inode_unlock (struct inode *inode)
 {
-  lock_release (&inode->lock);
+  rw_write_release (&inode->lock);
+}
+
+/* Locks INODE for shared use, as when searching or reading a
+   directory.  Any number of threads may hold it this way at
+   once. */
+void
+inode_lock_shared (struct inode *inode)
+{
+  rw_read_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock, taken with inode_lock_shared(). */
+void
+inode_unlock_shared (struct inode *inode)
+{
+  rw_read_release (&inode->lock);
 }
 
 
@@ -13,19 +13,30 @@ FILE_INODE, /* Ordinary file. */
 DIR_INODE /* Directory. */
 };
 void inode_init (void);
+void inode_done (void);
 struct inode *inode_create (block_sector_t, enum inode_type);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 enum inode_type inode_get_type (const struct inode *);
+enum inode_type inode_get_type_at (block_sector_t);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t length,
+                     bool extend);
+block_sector_t inode_byte_to_sector (struct inode *, off_t offset);
+void inode_reserve (struct inode *, off_t offset, off_t length);
+void inode_unreserve (struct inode *);
+off_t inode_max_length (void);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 int inode_open_cnt (const struct inode *);
 void inode_lock (struct inode *);
 void inode_unlock (struct inode *);
+void inode_lock_shared (struct inode *);
+void inode_unlock_shared (struct inode *);
 #endif /* filesys/inode.h */
@@ -0,0 +1,407 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* The journal takes up JOURNAL_SECTOR_CNT sectors starting at
+   JOURNAL_SECTOR: a header sector, followed by a circular log of
+   LOG_CNT sectors.
+
+   Metadata (inodes, index blocks and directories) is changed only
+   inside transactions, bracketed by journal_begin() and
+   journal_end(), and only in the buffer cache, which holds dirty
+   metadata back from the disk.  A commit waits for running
+   transactions to end, then appends every dirty metadata sector
+   to the log as one record: a descriptor listing the sectors,
+   their contents, and a commit sector.  Only then are the sectors
+   written in place, after which the header is advanced past the
+   record.  After a crash, journal_init() redoes the records that
+   the header has not been advanced past, so recovery reads at
+   most the log, however large the disk.
+
+   The free map is kept in memory and does not go through the
+   cache.  A commit logs the sectors of the free map file that
+   have changed since the last one, in the same record as the
+   metadata.  If there are more of them than fit, the rest go
+   first, in records of their own.  A crash between those records
+   can only leave sectors marked used that nothing points to,
+   since sectors are freed in memory only once their release has
+   been committed.
+
+   Dirty metadata cannot leave the cache before a commit, and a
+   commit cannot start while a transaction runs, so a transaction
+   that found the cache full of metadata would wait forever.  To
+   rule that out, each transaction states up front how many
+   metadata sectors it may dirty, and journal_begin() admits it
+   only if that many entries are still free for metadata,
+   committing first if need be.  Entries are also kept back for
+   sectors that other threads have pinned. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_CNT (JOURNAL_SECTOR_CNT - 1)
+
+/* Most sectors a single record can log. */
+#define RECORD_MAX ((BLOCK_SECTOR_SIZE - 12) / 4)
+
+/* Cache entries that metadata may never fill, so that sectors
+   pinned by threads outside transactions can still be loaded. */
+#define PIN_SLACK 8
+
+/* Every dirty metadata sector in the cache must fit in one
+   record. */
+#if CACHE_CNT > RECORD_MAX || RECORD_MAX + 2 > LOG_CNT
+#error Journal too small for the buffer cache.
+#endif
+
+/* Pages that hold the sectors of one record. */
+#define RECORD_PAGES DIV_ROUND_UP (RECORD_MAX * BLOCK_SECTOR_SIZE, PGSIZE)
+
+#define HEADER_MAGIC 0x4a524e4c         /* "JRNL". */
+#define DESCRIPTOR_MAGIC 0x44455343     /* "DESC". */
+#define COMMIT_MAGIC 0x434d4954         /* "CMIT". */
+
+/* Journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /* HEADER_MAGIC. */
+    unsigned seq;                       /* Sequence number of next record. */
+    block_sector_t start;               /* Log position of next record. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+  };
+
+/* First sector of a log record. */
+struct descriptor
+  {
+    unsigned magic;                     /* DESCRIPTOR_MAGIC. */
+    unsigned seq;                       /* Record sequence number. */
+    unsigned cnt;                       /* Number of logged sectors. */
+    block_sector_t sectors[RECORD_MAX]; /* Where they belong. */
+  };
+
+/* Last sector of a log record.  A record without one was cut
+   short by a crash and is ignored. */
+struct commit
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    unsigned seq;                       /* Record sequence number. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+static bool journal_ready;              /* Accepting commits? */
+static unsigned next_seq;               /* Sequence number of next record. */
+static block_sector_t log_head;         /* Log position of next record. */
+
+/* Transactions. */
+static struct lock journal_lock;        /* Protects the members below. */
+static struct condition journal_cond;   /* Signaled when either changes. */
+static int active_cnt;                  /* Threads inside a transaction. */
+static size_t reserved_cnt;             /* Their credits, summed. */
+static bool committing;                 /* Commit waiting or running? */
+static size_t meta_max;                 /* Most dirty metadata sectors. */
+
+/* Commits. */
+static struct lock commit_lock;         /* Serializes commits. */
+static struct descriptor descriptor;    /* Record being written. */
+static struct commit commit;
+static uint8_t *record_data;            /* Copies of logged sectors. */
+
+static void recover (void);
+static void write_header (void);
+
+/* Returns the sector at log position POS, wrapping around. */
+static block_sector_t
+log_sector (block_sector_t pos)
+{
+  return LOG_START + pos % LOG_CNT;
+}
+
+/* Initializes the journal.  If FORMAT is true, starts an empty
+   log; otherwise, first redoes whatever committed records the
+   log holds, so that the disk reflects every completed commit. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct descriptor) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct commit) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  active_cnt = 0;
+  reserved_cnt = 0;
+  committing = false;
+  lock_init (&commit_lock);
+
+  meta_max = CACHE_CNT - PIN_SLACK;
+  record_data = palloc_get_multiple (PAL_ASSERT, RECORD_PAGES);
+
+  if (format)
+    {
+      block_sector_t pos;
+
+      /* Clear the whole log.  Records left by an earlier file
+         system on this disk carry sequence numbers that the new
+         log will reach, and recovery must not mistake one for a
+         record of ours. */
+      memset (record_data, 0, RECORD_MAX * BLOCK_SECTOR_SIZE);
+      for (pos = 0; pos < LOG_CNT; pos += RECORD_MAX)
+        block_write_multi (fs_device, log_sector (pos), record_data,
+                           LOG_CNT - pos < RECORD_MAX ? LOG_CNT - pos
+                                                      : RECORD_MAX);
+
+      next_seq = 1;
+      log_head = 0;
+      write_header ();
+    }
+  else
+    recover ();
+
+  journal_ready = true;
+}
+
+/* Redoes the committed records in the log. */
+static void
+recover (void)
+{
+  struct journal_header *header = (struct journal_header *) record_data;
+  uint8_t *data = record_data;
+  size_t record_cnt = 0;
+
+  block_read (fs_device, JOURNAL_SECTOR, header);
+  if (header->magic != HEADER_MAGIC)
+    PANIC ("file system has no journal; reformat it");
+  next_seq = header->seq;
+  log_head = header->start % LOG_CNT;
+
+  for (;;)
+    {
+      size_t i;
+
+      block_read (fs_device, log_sector (log_head), &descriptor);
+      if (descriptor.magic != DESCRIPTOR_MAGIC
+          || descriptor.seq != next_seq
+          || descriptor.cnt > RECORD_MAX)
+        break;
+      block_read (fs_device, log_sector (log_head + 1 + descriptor.cnt),
+                  &commit);
+      if (commit.magic != COMMIT_MAGIC || commit.seq != next_seq)
+        break;
+
+      for (i = 0; i < descriptor.cnt; i++)
+        {
+          block_read (fs_device, log_sector (log_head + 1 + i), data);
+          block_write (fs_device, descriptor.sectors[i], data);
+        }
+      log_head = (log_head + descriptor.cnt + 2) % LOG_CNT;
+      next_seq++;
+      record_cnt++;
+    }
+
+  if (record_cnt > 0)
+    {
+      printf ("journal: redid %zu record(s)\n", record_cnt);
+      write_header ();
+    }
+}
+
+/* Writes the journal header, recording that every record before
+   log_head has reached its place on disk. */
+static void
+write_header (void)
+{
+  struct journal_header *header = (struct journal_header *) record_data;
+
+  memset (header, 0, sizeof *header);
+  header->magic = HEADER_MAGIC;
+  header->seq = next_seq;
+  header->start = log_head;
+  block_write (fs_device, JOURNAL_SECTOR, header);
+}
+
+/* Starts a transaction in the current thread that dirties at
+   most JOURNAL_CREDITS metadata sectors, as
+   journal_begin_cnt(). */
+void
+journal_begin (void)
+{
+  journal_begin_cnt (JOURNAL_CREDITS);
+}
+
+/* Starts a transaction in the current thread that dirties at
+   most SECTOR_CNT metadata sectors, waiting for any commit in
+   progress to finish and for the cache to have room for that
+   many.  If it does not, and no other transaction is running to
+   end and make way for a commit, commits right away.
+   Transactions nest; only the outermost journal_begin() and
+   journal_end() count, and a nested transaction lives on its
+   outermost one's credits.
+
+   A thread must acquire any lock that it needs for the change
+   before starting the transaction, not during it, because a
+   commit waits for every running transaction to end. */
+void
+journal_begin_cnt (size_t sector_cnt)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  ASSERT (sector_cnt <= meta_max);
+  lock_acquire (&journal_lock);
+  while (committing
+         || cache_meta_cnt () + reserved_cnt + sector_cnt > meta_max)
+    if (!committing && active_cnt == 0)
+      {
+        lock_release (&journal_lock);
+        journal_commit ();
+        lock_acquire (&journal_lock);
+      }
+    else
+      cond_wait (&journal_cond, &journal_lock);
+  active_cnt++;
+  reserved_cnt += sector_cnt;
+  lock_release (&journal_lock);
+
+  t->journal_credits = sector_cnt;
+  t->journal_dirtied = 0;
+}
+
+/* Charges a newly dirtied metadata sector to the current
+   thread's transaction, if it is in one.  Called by the buffer
+   cache.  Panics if the transaction exceeds its credits, which
+   would break journal_begin_cnt()'s accounting. */
+void
+journal_charge (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0 && ++t->journal_dirtied > t->journal_credits)
+    PANIC ("journal transaction dirtied more than %zu sectors",
+           t->journal_credits);
+}
+
+/* Ends the current thread's transaction. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  /* Wake both a waiting commit and transactions waiting for
+     room, one of which may have to commit. */
+  lock_acquire (&journal_lock);
+  active_cnt--;
+  reserved_cnt -= t->journal_credits;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes CNT sectors from DATA to the log starting at position
+   POS, splitting the write where the log wraps around. */
+static void
+write_log (block_sector_t pos, const uint8_t *data, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = LOG_CNT - pos % LOG_CNT;
+      if (n > cnt)
+        n = cnt;
+      block_write_multi (fs_device, log_sector (pos), data, n);
+      pos += n;
+      data += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Logs the first CNT sectors in record_data as one record, whose
+   first FREE_MAP_CNT sectors belong to the free map, then writes
+   them in place and advances the header past the record.  If
+   WITH_META, the rest are the cache's dirty metadata. */
+static void
+write_record (size_t cnt, size_t free_map_cnt, bool with_meta)
+{
+  size_t i;
+
+  descriptor.magic = DESCRIPTOR_MAGIC;
+  descriptor.seq = next_seq;
+  descriptor.cnt = cnt;
+  block_write (fs_device, log_sector (log_head), &descriptor);
+  write_log (log_head + 1, record_data, cnt);
+  memset (&commit, 0, sizeof commit);
+  commit.magic = COMMIT_MAGIC;
+  commit.seq = next_seq;
+  block_write (fs_device, log_sector (log_head + 1 + cnt), &commit);
+
+  /* The record is durable.  Now the sectors may go in place, and
+     then the record may be forgotten. */
+  for (i = 0; i < free_map_cnt; i++)
+    block_write (fs_device, descriptor.sectors[i],
+                 record_data + i * BLOCK_SECTOR_SIZE);
+  if (with_meta)
+    cache_write_back_meta ();
+  log_head = (log_head + cnt + 2) % LOG_CNT;
+  next_seq++;
+  write_header ();
+}
+
+/* Commits every completed transaction: logs the dirty metadata in
+   the buffer cache and the changed part of the free map, then
+   writes them in place.  Waits for running transactions to end
+   first, and holds off new ones until it is done. */
+void
+journal_commit (void)
+{
+  bool all;
+
+  if (!journal_ready)
+    return;
+
+  lock_acquire (&commit_lock);
+
+  lock_acquire (&journal_lock);
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* Log the free map sectors that do not fit alongside the
+     metadata first, then the rest of them with the metadata.
+     Threads outside transactions may keep changing the free map
+     meanwhile, but none of the metadata refers to those
+     changes. */
+  do
+    {
+      size_t room = RECORD_MAX - cache_meta_cnt ();
+      size_t free_map_cnt = free_map_collect (descriptor.sectors,
+                                              record_data, room, &all);
+      size_t cnt = free_map_cnt;
+
+      if (all)
+        cnt += cache_collect_meta (descriptor.sectors + cnt,
+                                   record_data + cnt * BLOCK_SECTOR_SIZE);
+      if (cnt > 0)
+        write_record (cnt, free_map_cnt, all);
+    }
+  while (!all);
+
+  /* Removals are durable now, so their sectors may be reused. */
+  free_map_release_pending ();
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  lock_release (&commit_lock);
+}
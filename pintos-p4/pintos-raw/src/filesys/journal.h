@@ -0,0 +1,18 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Metadata sectors a transaction started with journal_begin() may
+   dirty.  Larger transactions must say how many they need. */
+#define JOURNAL_CREDITS 8
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_begin_cnt (size_t sector_cnt);
+void journal_charge (void);
+void journal_end (void);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -69,6 +70,30 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Examines a whole element at a time. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx = start;
+
+  while (idx < end)
+    {
+      elem_type elem = b->bits[elem_idx (idx)];
+      if (!value)
+        elem = ~elem;
+      elem &= (elem_type) -1 << (idx % ELEM_BITS);
+      if (elem != 0)
+        {
+          idx = idx - idx % ELEM_BITS + __builtin_ctzl (elem);
+          return idx < end ? idx : end;
+        }
+      idx = idx - idx % ELEM_BITS + ELEM_BITS;
+    }
+  return end;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -239,10 +264,20 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  for (i = start; i < start + cnt; )
+    {
+      elem_type elem = b->bits[elem_idx (i)];
+      size_t bits = ELEM_BITS - i % ELEM_BITS;
+      if (bits > start + cnt - i)
+        bits = start + cnt - i;
+      elem >>= i % ELEM_BITS;
+      if (bits < ELEM_BITS)
+        elem &= ((elem_type) 1 << bits) - 1;
+      for (; elem != 0; elem &= elem - 1)
+        value_cnt++;
+      i += bits;
+    }
+  return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +285,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -301,10 +331,23 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+      if (cnt == 0 && start <= last)
+        return start;
+      while (i <= last)
+        {
+          /* Skip to the next bit set to VALUE, then see how far
+             the run it starts goes.  A run cut short resumes the
+             search past the bit that cut it. */
+          size_t end;
+          i = find_bit (b, i, last + 1, value);
+          if (i > last)
+            break;
+          end = find_bit (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -359,6 +402,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Copies the SIZE bytes starting at byte OFS of the file image
+   that bitmap_write() would write for B into BUF.  Bytes past the
+   end of the image read as zeros. */
+void
+bitmap_file_image (const struct bitmap *b, size_t ofs, void *buf,
+                   size_t size)
+{
+  size_t image_size = byte_cnt (b->bit_cnt);
+  size_t copy = ofs < image_size ? image_size - ofs : 0;
+
+  if (copy > size)
+    copy = size;
+  memcpy (buf, (const uint8_t *) b->bits + ofs, copy);
+  memset ((uint8_t *) buf + copy, 0, size - copy);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FALLOCATE,              /* Allocates disk space for a file. */
+    SYS_READDIR_BATCH,          /* Reads many directory entries. */
+    SYS_COPY_FILE_RANGE,        /* Copies data between files. */
+    SYS_READV,                  /* Reads into several buffers. */
+    SYS_WRITEV,                 /* Writes from several buffers. */
+    SYS_PREAD,                  /* Reads at a given offset. */
+    SYS_PWRITE                  /* Writes at a given offset. */
   };
 
 #endif /* lib/syscall-nr.h */
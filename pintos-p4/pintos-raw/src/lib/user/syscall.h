@@ -15,6 +15,24 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Directory entry, as written by readdir_batch(). */
+struct readdir_record
+  {
+    int inumber;                        /* Inode number. */
+    bool isdir;                         /* Directory or file? */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated name. */
+  };
+
+/* One buffer of a readv() or writev(). */
+struct iovec
+  {
+    void *iov_base;                     /* Start of buffer. */
+    unsigned iov_len;                   /* Length in bytes. */
+  };
+
+/* Most buffers readv() or writev() accept. */
+#define IOV_MAX 64
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -44,5 +62,12 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool fallocate (int fd, unsigned offset, unsigned length);
+int readdir_batch (int fd, struct readdir_record *, unsigned size);
+int copy_file_range (int src_fd, int dst_fd, unsigned length);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"src" => ["0123456789abcdef"], "dst" => ["xy456789abcdef"],
+		"d" => {}});
+pass;
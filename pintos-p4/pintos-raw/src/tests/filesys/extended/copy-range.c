@@ -0,0 +1,49 @@
+/* Copies the rest of one file onto the end of another with
+   copy_file_range, which must advance both file positions, then
+   passes it bad file descriptors, which must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int src_fd, dst_fd, dir_fd;
+  int copied;
+
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((src_fd = open ("src")) > 1, "open \"src\"");
+  CHECK ((dst_fd = open ("dst")) > 1, "open \"dst\"");
+  CHECK (write (src_fd, "0123456789abcdef", 16) == 16,
+         "write \"0123456789abcdef\" to \"src\"");
+  CHECK (write (dst_fd, "xy", 2) == 2, "write \"xy\" to \"dst\"");
+
+  seek (src_fd, 4);
+  copied = copy_file_range (src_fd, dst_fd, 100);
+  CHECK (copied == 12, "copy_file_range (must return 12, actually %d)",
+         copied);
+  CHECK (tell (src_fd) == 16, "tell \"src\" (must be 16, actually %u)",
+         tell (src_fd));
+  CHECK (tell (dst_fd) == 14, "tell \"dst\" (must be 14, actually %u)",
+         tell (dst_fd));
+  CHECK (copy_file_range (src_fd, dst_fd, 100) == 0,
+         "copy_file_range at end of \"src\" (must return 0)");
+
+  CHECK (copy_file_range (1234, dst_fd, 4) == -1,
+         "copy_file_range bad source fd (must return -1)");
+  CHECK (copy_file_range (src_fd, 1234, 4) == -1,
+         "copy_file_range bad destination fd (must return -1)");
+  CHECK (copy_file_range (src_fd, src_fd, 4) == -1,
+         "copy_file_range onto itself (must return -1)");
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (copy_file_range (dir_fd, dst_fd, 4) == -1,
+         "copy_file_range from directory (must return -1)");
+  close (dir_fd);
+  close (src_fd);
+  close (dst_fd);
+
+  check_file ("dst", "xy456789abcdef", 14);
+}
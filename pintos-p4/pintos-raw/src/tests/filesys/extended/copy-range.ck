@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-range) begin
+(copy-range) create "src"
+(copy-range) create "dst"
+(copy-range) open "src"
+(copy-range) open "dst"
+(copy-range) write "0123456789abcdef" to "src"
+(copy-range) write "xy" to "dst"
+(copy-range) copy_file_range (must return 12, actually 12)
+(copy-range) tell "src" (must be 16, actually 16)
+(copy-range) tell "dst" (must be 14, actually 14)
+(copy-range) copy_file_range at end of "src" (must return 0)
+(copy-range) copy_file_range bad source fd (must return -1)
+(copy-range) copy_file_range bad destination fd (must return -1)
+(copy-range) copy_file_range onto itself (must return -1)
+(copy-range) mkdir "d"
+(copy-range) open "d"
+(copy-range) copy_file_range from directory (must return -1)
+(copy-range) open "dst" for verification
+(copy-range) verified contents of "dst"
+(copy-range) close "dst"
+(copy-range) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir);
+$dir->{"b$_"} = [''] foreach 0...199;
+check_archive ({"d" => $dir});
+pass;
@@ -0,0 +1,71 @@
+/* Fills a directory well past one sector of entries, so that it
+   is converted to hashed format, removes every file, and fills it
+   again with different names.  Checks that each lookup finds
+   exactly the files that currently exist. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+static void
+make_files (char prefix)
+{
+  char name[16];
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/d/%c%d", prefix, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+}
+
+static void
+check_files (char prefix, bool exist)
+{
+  char name[16];
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "/d/%c%d", prefix, i);
+      fd = open (name);
+      if ((fd > 1) != exist)
+        fail ("open \"%s\" %s", name, exist ? "failed" : "succeeded");
+      if (fd > 1)
+        close (fd);
+    }
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i;
+
+  CHECK (mkdir ("/d"), "mkdir \"/d\"");
+
+  msg ("creating files a0...a%d", FILE_CNT - 1);
+  make_files ('a');
+  check_files ('a', true);
+
+  msg ("removing files a0...a%d", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "/d/a%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  check_files ('a', false);
+
+  msg ("creating files b0...b%d", FILE_CNT - 1);
+  make_files ('b');
+  check_files ('b', true);
+  check_files ('a', false);
+}
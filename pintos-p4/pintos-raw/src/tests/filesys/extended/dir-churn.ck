@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-churn) begin
+(dir-churn) mkdir "/d"
+(dir-churn) creating files a0...a199
+(dir-churn) removing files a0...a199
+(dir-churn) creating files b0...b199
+(dir-churn) end
+EOF
+pass;
@@ -0,0 +1,35 @@
+/* Checks readdir, isdir, and inumber on a directory and a file,
+   so that each reaches its own handler. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  bool found_x = false;
+  int fd, x_fd;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/x", 0), "create \"d/x\"");
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  CHECK ((x_fd = open ("d/x")) > 1, "open \"d/x\"");
+
+  CHECK (isdir (fd), "isdir \"d\" (must be true)");
+  CHECK (!isdir (x_fd), "isdir \"d/x\" (must be false)");
+  CHECK (inumber (fd) != inumber (x_fd),
+         "inumber \"d\" and \"d/x\" (must differ)");
+
+  /* "." and "..", if listed at all, are not checked here. */
+  msg ("readdir \"d\"");
+  while (readdir (fd, name))
+    if (!strcmp (name, "x"))
+      found_x = true;
+    else if (strcmp (name, ".") && strcmp (name, ".."))
+      fail ("unexpected entry \"%s\"", name);
+  CHECK (found_x, "found \"x\"");
+  CHECK (!readdir (x_fd, name), "readdir \"d/x\" (must fail)");
+}
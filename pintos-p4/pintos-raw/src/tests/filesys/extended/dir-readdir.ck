@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-readdir) begin
+(dir-readdir) mkdir "d"
+(dir-readdir) create "d/x"
+(dir-readdir) open "d"
+(dir-readdir) open "d/x"
+(dir-readdir) isdir "d" (must be true)
+(dir-readdir) isdir "d/x" (must be false)
+(dir-readdir) inumber "d" and "d/x" (must differ)
+(dir-readdir) readdir "d"
+(dir-readdir) found "x"
+(dir-readdir) readdir "d/x" (must fail)
+(dir-readdir) end
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Grows an empty file with fallocate, which must leave it full
+   of zeros and its position alone, then passes it a bad file
+   descriptor, a directory, and an offset past any file's end,
+   which must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char zeros[5000];
+
+void
+test_main (void) 
+{
+  int fd, dir_fd;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (fallocate (fd, 0, 5000), "fallocate 5000 bytes");
+  CHECK (filesize (fd) == 5000,
+         "filesize \"a\" (must be 5000, actually %d)", filesize (fd));
+  CHECK (tell (fd) == 0, "tell \"a\" (must be 0, actually %u)", tell (fd));
+  CHECK (fallocate (fd, 100, 10), "fallocate inside the file");
+  CHECK (filesize (fd) == 5000,
+         "filesize \"a\" (must be 5000, actually %d)", filesize (fd));
+
+  CHECK (!fallocate (1234, 0, 10), "fallocate bad fd (must fail)");
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (!fallocate (dir_fd, 0, 10), "fallocate directory (must fail)");
+  CHECK (!fallocate (fd, 0x80000000, 10),
+         "fallocate at offset 0x80000000 (must fail)");
+  close (dir_fd);
+  close (fd);
+
+  check_file ("a", zeros, sizeof zeros);
+}
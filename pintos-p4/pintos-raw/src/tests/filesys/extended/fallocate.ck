@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "a"
+(fallocate) open "a"
+(fallocate) fallocate 5000 bytes
+(fallocate) filesize "a" (must be 5000, actually 5000)
+(fallocate) tell "a" (must be 0, actually 0)
+(fallocate) fallocate inside the file
+(fallocate) filesize "a" (must be 5000, actually 5000)
+(fallocate) fallocate bad fd (must fail)
+(fallocate) mkdir "d"
+(fallocate) open "d"
+(fallocate) fallocate directory (must fail)
+(fallocate) fallocate at offset 0x80000000 (must fail)
+(fallocate) open "a" for verification
+(fallocate) verified contents of "a"
+(fallocate) close "a"
+(fallocate) end
+EOF
+pass;
@@ -0,0 +1,38 @@
+/* Writes a file that takes up more than half of the disk, removes
+   it, and does so twice more.  Each file fits only if removing
+   the one before really freed its sectors. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (1200 * 1024)
+#define PASS_CNT 3
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  int pass;
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      size_t ofs;
+      int fd;
+
+      memset (buf, 'a' + pass, sizeof buf);
+      CHECK (create ("big", 0), "create \"big\"");
+      CHECK ((fd = open ("big")) > 1, "open \"big\"");
+      msg ("writing \"big\"");
+      for (ofs = 0; ofs < FILE_SIZE; ofs += sizeof buf)
+        if (write (fd, buf, sizeof buf) != (int) sizeof buf)
+          fail ("write %zu bytes at offset %zu in \"big\" failed",
+                sizeof buf, ofs);
+      CHECK (filesize (fd) == FILE_SIZE, "filesize \"big\"");
+      msg ("close \"big\"");
+      close (fd);
+      CHECK (remove ("big"), "remove \"big\"");
+    }
+}
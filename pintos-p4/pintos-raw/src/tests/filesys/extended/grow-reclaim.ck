@@ -0,0 +1,27 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-reclaim) begin
+(grow-reclaim) create "big"
+(grow-reclaim) open "big"
+(grow-reclaim) writing "big"
+(grow-reclaim) filesize "big"
+(grow-reclaim) close "big"
+(grow-reclaim) remove "big"
+(grow-reclaim) create "big"
+(grow-reclaim) open "big"
+(grow-reclaim) writing "big"
+(grow-reclaim) filesize "big"
+(grow-reclaim) close "big"
+(grow-reclaim) remove "big"
+(grow-reclaim) create "big"
+(grow-reclaim) open "big"
+(grow-reclaim) writing "big"
+(grow-reclaim) filesize "big"
+(grow-reclaim) close "big"
+(grow-reclaim) remove "big"
+(grow-reclaim) end
+EOF
+pass;
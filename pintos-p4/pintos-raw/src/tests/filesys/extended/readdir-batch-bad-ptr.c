@@ -0,0 +1,19 @@
+/* Passes readdir_batch a buffer in kernel memory.  The process
+   must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/x", 0), "create \"d/x\"");
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+
+  readdir_batch (fd, (struct readdir_record *) 0xc0100000, 4096);
+  fail ("should not have survived readdir_batch()");
+}
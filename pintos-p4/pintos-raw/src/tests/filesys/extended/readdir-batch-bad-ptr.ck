@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(readdir-batch-bad-ptr) begin
+(readdir-batch-bad-ptr) mkdir "d"
+(readdir-batch-bad-ptr) create "d/x"
+(readdir-batch-bad-ptr) open "d"
+readdir-batch-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,68 @@
+/* Lists a directory holding a file and a directory with
+   readdir_batch, which must report each one's inode number and
+   type, then passes it a bad file descriptor, a file, and a
+   buffer too small for one record, which must fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct readdir_record recs[4];
+  int x_inumber, y_inumber;
+  bool found_x = false, found_y = false;
+  int fd, x_fd, y_fd;
+  int bytes;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/x", 0), "create \"d/x\"");
+  CHECK (mkdir ("d/y"), "mkdir \"d/y\"");
+  CHECK ((x_fd = open ("d/x")) > 1, "open \"d/x\"");
+  CHECK ((y_fd = open ("d/y")) > 1, "open \"d/y\"");
+  x_inumber = inumber (x_fd);
+  y_inumber = inumber (y_fd);
+
+  /* "." and "..", if listed at all, are not checked here. */
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  msg ("readdir_batch \"d\"");
+  while ((bytes = readdir_batch (fd, recs, sizeof recs)) > 0)
+    {
+      int i;
+
+      if (bytes % sizeof *recs != 0)
+        fail ("readdir_batch returned %d, not a whole number of records",
+              bytes);
+      for (i = 0; i < bytes / (int) sizeof *recs; i++)
+        {
+          struct readdir_record *r = &recs[i];
+
+          if (!strcmp (r->name, "x"))
+            {
+              if (found_x || r->inumber != x_inumber || r->isdir)
+                fail ("bad record for \"x\"");
+              found_x = true;
+            }
+          else if (!strcmp (r->name, "y"))
+            {
+              if (found_y || r->inumber != y_inumber || !r->isdir)
+                fail ("bad record for \"y\"");
+              found_y = true;
+            }
+          else if (strcmp (r->name, ".") && strcmp (r->name, ".."))
+            fail ("unexpected entry \"%s\"", r->name);
+        }
+    }
+  CHECK (bytes == 0, "readdir_batch at end (must return 0, actually %d)",
+         bytes);
+  CHECK (found_x && found_y, "found \"x\" and \"y\"");
+
+  CHECK (readdir_batch (1234, recs, sizeof recs) == -1,
+         "readdir_batch bad fd (must return -1)");
+  CHECK (readdir_batch (x_fd, recs, sizeof recs) == -1,
+         "readdir_batch file (must return -1)");
+  CHECK (readdir_batch (y_fd, recs, sizeof *recs - 1) == -1,
+         "readdir_batch short buffer (must return -1)");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readdir-batch) begin
+(readdir-batch) mkdir "d"
+(readdir-batch) create "d/x"
+(readdir-batch) mkdir "d/y"
+(readdir-batch) open "d/x"
+(readdir-batch) open "d/y"
+(readdir-batch) open "d"
+(readdir-batch) readdir_batch "d"
+(readdir-batch) readdir_batch at end (must return 0, actually 0)
+(readdir-batch) found "x" and "y"
+(readdir-batch) readdir_batch bad fd (must return -1)
+(readdir-batch) readdir_batch file (must return -1)
+(readdir-batch) readdir_batch short buffer (must return -1)
+(readdir-batch) end
+EOF
+pass;
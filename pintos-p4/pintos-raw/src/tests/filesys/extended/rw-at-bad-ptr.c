@@ -0,0 +1,20 @@
+/* Passes pread a buffer that runs from user memory into the
+   kernel.  The process must be terminated with -1 exit code,
+   before any of the file is read into the buffer. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, "0123456789", 10) == 10, "write \"0123456789\"");
+
+  pread (fd, (char *) 0xc0000000 - 4, 10, 0);
+  fail ("should not have survived pread()");
+}
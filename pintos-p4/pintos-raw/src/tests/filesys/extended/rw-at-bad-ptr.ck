@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rw-at-bad-ptr) begin
+(rw-at-bad-ptr) create "a"
+(rw-at-bad-ptr) open "a"
+(rw-at-bad-ptr) write "0123456789"
+rw-at-bad-ptr: exit(-1)
+EOF
+pass;
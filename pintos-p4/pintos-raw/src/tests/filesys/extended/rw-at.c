@@ -0,0 +1,48 @@
+/* Writes and reads a file with pwrite and pread, which must use
+   the offset they are given and leave the file position alone,
+   then passes them bad file descriptors, which must fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[16];
+  int fd, dir_fd;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, "0123456789", 10) == 10, "write \"0123456789\"");
+
+  CHECK (pwrite (fd, "abc", 3, 4) == 3, "pwrite \"abc\" at offset 4");
+  CHECK (pwrite (fd, "xyz", 3, 10) == 3, "pwrite \"xyz\" at offset 10");
+  CHECK (tell (fd) == 10, "tell \"a\" (must be 10, actually %u)", tell (fd));
+  CHECK (filesize (fd) == 13,
+         "filesize \"a\" (must be 13, actually %d)", filesize (fd));
+
+  CHECK (pread (fd, buf, 5, 2) == 5, "pread 5 bytes at offset 2");
+  CHECK (!memcmp (buf, "23abc", 5), "pread returned \"23abc\"");
+  CHECK (pread (fd, buf, sizeof buf, 11) == 2,
+         "pread at offset 11 (must return 2)");
+  CHECK (pread (fd, buf, sizeof buf, 13) == 0,
+         "pread at end of file (must return 0)");
+  CHECK (tell (fd) == 10, "tell \"a\" (must be 10, actually %u)", tell (fd));
+
+  CHECK (pread (1234, buf, 5, 0) == -1, "pread bad fd (must return -1)");
+  CHECK (pwrite (1234, "abc", 3, 0) == -1, "pwrite bad fd (must return -1)");
+  CHECK (pread (-1, buf, 5, 0) == -1, "pread fd -1 (must return -1)");
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (pread (dir_fd, buf, 5, 0) == -1,
+         "pread directory (must return -1)");
+  CHECK (pwrite (dir_fd, "abc", 3, 0) == -1,
+         "pwrite directory (must return -1)");
+  close (dir_fd);
+  close (fd);
+
+  check_file ("a", "0123abc789xyz", 13);
+}
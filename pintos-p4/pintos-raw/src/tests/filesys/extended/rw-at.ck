@@ -0,0 +1,31 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(rw-at) begin
+(rw-at) create "a"
+(rw-at) open "a"
+(rw-at) write "0123456789"
+(rw-at) pwrite "abc" at offset 4
+(rw-at) pwrite "xyz" at offset 10
+(rw-at) tell "a" (must be 10, actually 10)
+(rw-at) filesize "a" (must be 13, actually 13)
+(rw-at) pread 5 bytes at offset 2
+(rw-at) pread returned "23abc"
+(rw-at) pread at offset 11 (must return 2)
+(rw-at) pread at end of file (must return 0)
+(rw-at) tell "a" (must be 10, actually 10)
+(rw-at) pread bad fd (must return -1)
+(rw-at) pwrite bad fd (must return -1)
+(rw-at) pread fd -1 (must return -1)
+(rw-at) mkdir "d"
+(rw-at) open "d"
+(rw-at) pread directory (must return -1)
+(rw-at) pwrite directory (must return -1)
+(rw-at) open "a" for verification
+(rw-at) verified contents of "a"
+(rw-at) close "a"
+(rw-at) end
+EOF
+pass;
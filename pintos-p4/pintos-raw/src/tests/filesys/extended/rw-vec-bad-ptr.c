@@ -0,0 +1,25 @@
+/* Passes writev a good buffer followed by one in kernel memory.
+   The process must be terminated with -1 exit code, before even
+   the good buffer is written. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct iovec out[2];
+  int fd;
+
+  out[0].iov_base = (void *) "Hello";
+  out[0].iov_len = 5;
+  out[1].iov_base = (void *) 0xc0100000;
+  out[1].iov_len = 123;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+
+  writev (fd, out, 2);
+  fail ("should not have survived writev()");
+}
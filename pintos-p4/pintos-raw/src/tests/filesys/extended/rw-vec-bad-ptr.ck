@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rw-vec-bad-ptr) begin
+(rw-vec-bad-ptr) create "a"
+(rw-vec-bad-ptr) open "a"
+rw-vec-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,61 @@
+/* Writes a file with writev and reads it back with readv, which
+   must fill each buffer in turn, then passes them bad file
+   descriptors and bad buffer counts, which must fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static struct iovec many[IOV_MAX + 1];
+  struct iovec out[3];
+  struct iovec in[2];
+  char head[3], tail[16];
+  char byte;
+  int fd;
+  int i;
+
+  out[0].iov_base = (void *) "Hello";
+  out[0].iov_len = 5;
+  out[1].iov_base = (void *) ", ";
+  out[1].iov_len = 2;
+  out[2].iov_base = (void *) "world";
+  out[2].iov_len = 5;
+  in[0].iov_base = head;
+  in[0].iov_len = sizeof head;
+  in[1].iov_base = tail;
+  in[1].iov_len = sizeof tail;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (writev (fd, out, 3) == 12, "writev 3 buffers (must return 12)");
+  CHECK (tell (fd) == 12, "tell \"a\" (must be 12, actually %u)", tell (fd));
+
+  seek (fd, 0);
+  CHECK (readv (fd, in, 2) == 12, "readv 2 buffers (must return 12)");
+  CHECK (!memcmp (head, "Hel", 3), "first buffer holds \"Hel\"");
+  CHECK (!memcmp (tail, "lo, world", 9),
+         "second buffer holds \"lo, world\"");
+  CHECK (readv (fd, in, 2) == 0, "readv at end of file (must return 0)");
+
+  CHECK (writev (1234, out, 3) == -1, "writev bad fd (must return -1)");
+  CHECK (readv (1234, in, 2) == -1, "readv bad fd (must return -1)");
+  CHECK (readv (-1, in, 2) == -1, "readv fd -1 (must return -1)");
+
+  for (i = 0; i < IOV_MAX + 1; i++)
+    {
+      many[i].iov_base = &byte;
+      many[i].iov_len = 1;
+    }
+  CHECK (writev (fd, many, 0) == -1, "writev 0 buffers (must return -1)");
+  CHECK (writev (fd, many, IOV_MAX + 1) == -1,
+         "writev %d buffers (must return -1)", IOV_MAX + 1);
+  CHECK (readv (fd, many, IOV_MAX + 1) == -1,
+         "readv %d buffers (must return -1)", IOV_MAX + 1);
+  close (fd);
+
+  check_file ("a", "Hello, world", 12);
+}
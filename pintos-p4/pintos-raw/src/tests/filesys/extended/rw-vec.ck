@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(rw-vec) begin
+(rw-vec) create "a"
+(rw-vec) open "a"
+(rw-vec) writev 3 buffers (must return 12)
+(rw-vec) tell "a" (must be 12, actually 12)
+(rw-vec) readv 2 buffers (must return 12)
+(rw-vec) first buffer holds "Hel"
+(rw-vec) second buffer holds "lo, world"
+(rw-vec) readv at end of file (must return 0)
+(rw-vec) writev bad fd (must return -1)
+(rw-vec) readv bad fd (must return -1)
+(rw-vec) readv fd -1 (must return -1)
+(rw-vec) writev 0 buffers (must return -1)
+(rw-vec) writev 65 buffers (must return -1)
+(rw-vec) readv 65 buffers (must return -1)
+(rw-vec) open "a" for verification
+(rw-vec) verified contents of "a"
+(rw-vec) close "a"
+(rw-vec) end
+EOF
+pass;
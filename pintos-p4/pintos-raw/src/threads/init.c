@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -247,6 +248,18 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ra"))
+        {
+          /* At most 9 digits, so that atoi() cannot overflow. */
+          if (value == NULL || *value == '\0'
+              || value[strspn (value, "0123456789")] != '\0'
+              || strlen (value) > 9)
+            PANIC ("invalid read-ahead window `%s' (use -h for help)",
+                   value != NULL ? value : "");
+          file_readahead_window = atoi (value);
+          if (file_readahead_window > FILE_READAHEAD_MAX)
+            file_readahead_window = FILE_READAHEAD_MAX;
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +386,8 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ra=SECTORS        Read ahead SECTORS sectors for sequential reads\n"
+          "                     (at most %d; larger values are clamped).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -381,6 +396,9 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef FILESYS
+          , FILE_READAHEAD_MAX
 #endif
           );
   shutdown_power_off ();
@@ -495,14 +495,16 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
 
   //AMANDA ADDED HERE
-  t->next_file = 2;
-  list_init(&t->files);
+  t->fds = NULL;
+  t->fd_cnt = 0;
   list_init(&t->children);
 
   t->parent = NULL;
   t->child_process = NULL;
 
   t->cwd = NULL; // what should this be
+  t->journal_depth = 0;
+  t->journal_credits = t->journal_dirtied = 0;
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
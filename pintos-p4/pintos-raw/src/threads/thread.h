@@ -107,12 +107,15 @@ struct thread
    //  bool load;
    //  struct semaphore sema_load;
 
-    struct list files;
-    int next_file;
+    struct file_descriptor **fds;       /* Open files, indexed by handle. */
+    int fd_cnt;                         /* Number of slots in FDS. */
 
     /* Chris added here */
     struct file *executable;
     struct dir *cwd;
+    int journal_depth;                  /* Open journal transactions. */
+    size_t journal_credits;             /* Metadata sectors it may dirty. */
+    size_t journal_dirtied;             /* Metadata sectors it has dirtied. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -128,7 +131,6 @@ struct file_descriptor {
    int handle;
    struct file *file;
    struct dir *dir;
-   struct list_elem elem;
 };
 
 struct child_process {
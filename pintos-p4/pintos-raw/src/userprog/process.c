@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -179,6 +180,7 @@ process_exit (void)
   
   //thread_name() defined in thread.h, termination message defined in pintos_3.html
   printf("%s: exit(%d)\n", cur->name, cur->child_process->exit_status);
+  kill_the_table ();
   file_close (cur->executable);
 }
 
@@ -1,10 +1,12 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
+#include "threads/malloc.h"
 #include "filesys/filesys.h"
 #include "threads/synch.h"
 #include "threads/synch.h"
@@ -18,8 +20,6 @@
 #include "filesys/directory.h"
 
 
-static struct lock filesys_lock;
-
 //DECLARE
 static void syscall_handler (struct intr_frame *f);
 static int sys_exec (const char *cmd_line);
@@ -32,6 +32,11 @@ int sys_open (const char *file);
 int sys_filesize (int fd);
 int sys_read (int fd, void *buffer, unsigned size);
 int sys_write (int fd, const void *buffer, unsigned size);
+struct iovec;
+int sys_readv (int fd, const struct iovec *iov, int iovcnt);
+int sys_writev (int fd, const struct iovec *iov, int iovcnt);
+int sys_pread (int fd, void *buffer, unsigned size, unsigned offset);
+int sys_pwrite (int fd, const void *buffer, unsigned size, unsigned offset);
 void sys_seek (int fd, unsigned position);
 unsigned sys_tell (int fd);
 void sys_close (int fd);
@@ -40,6 +45,9 @@ bool sys_mkdir (const char *dir);
 bool sys_readdir (int fd, char *name);
 bool sys_isdir (int fd);
 int sys_inumber (int fd);
+bool sys_fallocate (int fd, unsigned offset, unsigned length);
+int sys_readdir_batch (int fd, void *buffer, unsigned size);
+int sys_copy_file_range (int src_fd, int dst_fd, unsigned length);
 
 void get_args_sys_halt(struct intr_frame *f, int *args);
 void get_args_sys_exit(struct intr_frame *f, int *args);
@@ -54,21 +62,37 @@ void get_args_sys_write(struct intr_frame *f, int *args);
 void get_args_sys_seek(struct intr_frame *f, int *args);
 void get_args_sys_tell(struct intr_frame *f, int *args);
 void get_args_sys_close(struct intr_frame *f, int *args);
+void get_args_sys_mmap(struct intr_frame *f, int *args);
+void get_args_sys_munmap(struct intr_frame *f, int *args);
 void get_args_sys_chdir(struct intr_frame *f, int *args);
 void get_args_sys_mkdir(struct intr_frame *f, int *args);
 void get_args_sys_readdir(struct intr_frame *f, int *args);
 void get_args_sys_isdir(struct intr_frame *f, int *args);
 void get_args_sys_inumber(struct intr_frame *f, int *args);
+void get_args_sys_fallocate(struct intr_frame *f, int *args);
+void get_args_sys_readdir_batch(struct intr_frame *f, int *args);
+void get_args_sys_copy_file_range(struct intr_frame *f, int *args);
+void get_args_sys_readv(struct intr_frame *f, int *args);
+void get_args_sys_writev(struct intr_frame *f, int *args);
+void get_args_sys_pread(struct intr_frame *f, int *args);
+void get_args_sys_pwrite(struct intr_frame *f, int *args);
 
 /*HELPER FUNCTIONS DECLARED HERE*/
 struct file_descriptor *lookup_fd(int handle);
 int add_file_to_file_table(struct file *add_me_file);
+int add_dir_to_file_table(struct dir *dir);
 static void copy_in (void *dst_, const void *usrc_, size_t size);
+static void copy_out (void *udst_, const void *src_, size_t size);
 static char * copy_in_string (const char *us);
+static void check_user_range (const void *buffer, unsigned size,
+                              bool writable);
 static inline bool put_user (uint8_t *udst, uint8_t byte);
 static inline bool get_user (uint8_t *dst, const uint8_t *usrc);
+static int read_buffer (int fd, struct file_descriptor *filedescriptor,
+                        void *buffer, unsigned size);
+static int write_buffer (int fd, struct file_descriptor *filedescriptor,
+                         const void *buffer, unsigned size);
 void close_file(int fd);
-void kill_the_table(void);
 
 typedef void (*syscall_function)(struct intr_frame *, int *);
 
@@ -87,11 +111,20 @@ syscall_function table[] = {
   get_args_sys_seek,
   get_args_sys_tell,
   get_args_sys_close,
-  get_args_sys_readdir,
-  get_args_sys_isdir,
+  get_args_sys_mmap,
+  get_args_sys_munmap,
   get_args_sys_chdir,
   get_args_sys_mkdir,
-  get_args_sys_inumber
+  get_args_sys_readdir,
+  get_args_sys_isdir,
+  get_args_sys_inumber,
+  get_args_sys_fallocate,
+  get_args_sys_readdir_batch,
+  get_args_sys_copy_file_range,
+  get_args_sys_readv,
+  get_args_sys_writev,
+  get_args_sys_pread,
+  get_args_sys_pwrite
 };
 
 //functions to get the args for the handlers
@@ -147,6 +180,14 @@ void get_args_sys_close(struct intr_frame *f, int *args){
   sys_close(args[0]);
 }
 
+//no virtual memory in p4, so mapping always fails
+void get_args_sys_mmap(struct intr_frame *f, int *args UNUSED){
+  f->eax = -1;
+}
+
+void get_args_sys_munmap(struct intr_frame *f UNUSED, int *args UNUSED){
+}
+
 void get_args_sys_chdir(struct intr_frame *f, int *args) {
   f->eax = sys_chdir((const char *) args[0]);
 }
@@ -167,7 +208,43 @@ void get_args_sys_inumber(struct intr_frame *f, int *args) {
   f->eax = sys_inumber((int) args[0]);
 }
 
+void get_args_sys_fallocate(struct intr_frame *f, int *args) {
+  f->eax = sys_fallocate((int) args[0], (unsigned) args[1],
+                         (unsigned) args[2]);
+}
+
+void get_args_sys_readdir_batch(struct intr_frame *f, int *args) {
+  f->eax = sys_readdir_batch((int) args[0], (void *) args[1],
+                             (unsigned) args[2]);
+}
+
+void get_args_sys_copy_file_range(struct intr_frame *f, int *args) {
+  f->eax = sys_copy_file_range((int) args[0], (int) args[1],
+                               (unsigned) args[2]);
+}
+
+void get_args_sys_readv(struct intr_frame *f, int *args) {
+  f->eax = sys_readv((int) args[0], (const struct iovec *) args[1],
+                     (int) args[2]);
+}
+
+void get_args_sys_writev(struct intr_frame *f, int *args) {
+  f->eax = sys_writev((int) args[0], (const struct iovec *) args[1],
+                      (int) args[2]);
+}
+
+void get_args_sys_pread(struct intr_frame *f, int *args) {
+  f->eax = sys_pread((int) args[0], (void *) args[1], (unsigned) args[2],
+                     (unsigned) args[3]);
+}
+
+void get_args_sys_pwrite(struct intr_frame *f, int *args) {
+  f->eax = sys_pwrite((int) args[0], (const void *) args[1],
+                      (unsigned) args[2], (unsigned) args[3]);
+}
+
 //this feels stupid but number of args per handler
+//(indexed by syscall number, like table)
 const int arg_counts[] = {
   0,
   1,
@@ -182,11 +259,20 @@ const int arg_counts[] = {
   2,
   1,
   1,
+  2,
+  1,
   1,
   1,
   2,
   1,
-  1
+  1,
+  3,
+  3,
+  3,
+  3,
+  3,
+  4,
+  4
 };
 
 
@@ -248,9 +334,7 @@ bool sys_create (const char *file, unsigned initial_size){
   }
 
   bool created;
-  lock_acquire(&filesys_lock);
   created = filesys_create(filename, initial_size, FILE_INODE);
-  lock_release(&filesys_lock);
 
   //free the copy_in_string thing
   palloc_free_page(filename);
@@ -269,9 +353,7 @@ bool sys_remove (const char *file){
   char *filename = copy_in_string(file);
   
   bool removed;
-  lock_acquire(&filesys_lock);
   removed = filesys_remove (filename);
-  lock_release(&filesys_lock);
 
   palloc_free_page(filename);
 
@@ -290,7 +372,6 @@ int sys_open (const char *file){
     return -1;
   }
 
-  lock_acquire(&filesys_lock);
   struct inode *inode;
   if (!strcmp(filename, "/"))
   {
@@ -315,6 +396,9 @@ int sys_open (const char *file){
     }
 
     fd = add_file_to_file_table(filereal);
+    if (fd < 0){
+      file_close(filereal);
+    }
   }
   else
   {
@@ -325,9 +409,11 @@ int sys_open (const char *file){
     }
 
     fd = add_dir_to_file_table(dir);
+    if (fd < 0){
+      dir_close(dir);
+    }
   }
   
-  lock_release(&filesys_lock);
   palloc_free_page(filename);
 
   return fd;
@@ -365,6 +451,13 @@ int sys_read (int fd, void *buffer, unsigned size){
     return -1;
   }
 
+  return read_buffer(fd, filedescriptor, buffer, size);
+}
+
+//does the reading for sys_read and sys_readv, once the fd is looked up
+static int read_buffer (int fd, struct file_descriptor *filedescriptor,
+                        void *buffer, unsigned size){
+
   int sizeToRead = size;
   int bytes_read = 0;
 
@@ -476,6 +569,12 @@ int sys_write (int fd, const void *buffer, unsigned size){
     return -1;
   }
 
+  return write_buffer(fd, filedescriptor, buffer, size);
+}
+
+//does the writing for sys_write and sys_writev, once the fd is looked up
+static int write_buffer (int fd, struct file_descriptor *filedescriptor,
+                         const void *buffer, unsigned size){
 
   int sizeToWrite = size;
   int bytes_written = 0;
@@ -503,9 +602,6 @@ int sys_write (int fd, const void *buffer, unsigned size){
       }
       nbytes = (unsigned)tmp;
     } else {
-      if (!lock_held_by_current_thread(&filesys_lock))
-        lock_acquire(&filesys_lock);
-
       int tmp;
       if (filedescriptor->file != NULL)
       {
@@ -516,9 +612,6 @@ int sys_write (int fd, const void *buffer, unsigned size){
         return -1;
       }
 
-      if (lock_held_by_current_thread(&filesys_lock))
-        lock_release(&filesys_lock);
-
       if (tmp < 0){
         break;
       }
@@ -563,9 +656,7 @@ bool sys_mkdir(const char *dir)
   }
 
   bool created;
-  lock_acquire(&filesys_lock);
   created = filesys_create(dirname, 0, DIR_INODE);
-  lock_release(&filesys_lock);
 
   //free the copy_in_string thing
   palloc_free_page(dirname);
@@ -622,11 +713,224 @@ int sys_inumber(int fd)
   return inode_get_inumber(inode);
 }
 
+//reserve disk space for part of an open file, growing it if needed
+bool sys_fallocate(int fd, unsigned offset, unsigned length)
+{
+  struct file_descriptor *file_desc = lookup_fd(fd);
+
+  if (file_desc == NULL || file_desc->file == NULL)
+  {
+    return false;
+  }
+
+  if (offset > INT32_MAX || length > INT32_MAX)
+  {
+    return false;
+  }
+
+  return file_allocate(file_desc->file, offset, length);
+}
+
+//one directory entry as readdir_batch hands it to the user
+//(must match struct readdir_record in lib/user/syscall.h)
+struct readdir_record
+{
+  int inumber;
+  bool isdir;
+  char name[NAME_MAX + 1];
+};
+
+//fill the user's buffer with as many directory entries as fit,
+//returning the number of bytes filled (0 at the end of the directory)
+int sys_readdir_batch(int fd, void *buffer, unsigned size)
+{
+  struct file_descriptor *file_desc = lookup_fd(fd);
+  struct readdir_record rec;
+  uint8_t *udst = buffer;
+  int bytes = 0;
+
+  if (file_desc == NULL || file_desc->dir == NULL
+      || size < sizeof rec)
+  {
+    return -1;
+  }
+
+  while (size - bytes >= sizeof rec)
+  {
+    block_sector_t inumber;
+    enum inode_type type;
+
+    memset(&rec, 0, sizeof rec);
+    if (!dir_readdir_entry(file_desc->dir, rec.name, &inumber, &type))
+    {
+      break;
+    }
+    rec.inumber = inumber;
+    rec.isdir = type == DIR_INODE;
+
+    copy_out(udst + bytes, &rec, sizeof rec);
+    bytes += sizeof rec;
+  }
+
+  return bytes;
+}
+
+//one piece of a readv/writev transfer
+//(must match struct iovec in lib/user/syscall.h)
+struct iovec
+{
+  void *iov_base;
+  unsigned iov_len;
+};
+
+//most pieces one readv/writev may have
+#define IOV_MAX 64
+
+//copy in and check the user's iovec array, once for the whole call,
+//killing the process if any piece is not all mapped (and writable,
+//if WRITABLE); returns false if there are too many pieces (or none)
+//or their lengths add up to more than the int return value can hold
+static bool copy_in_iovecs(struct iovec *dst, const struct iovec *iov,
+                           int iovcnt, bool writable)
+{
+  unsigned total = 0;
+  int i;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX){
+    return false;
+  }
+
+  copy_in(dst, iov, iovcnt * sizeof *dst);
+  for (i = 0; i < iovcnt; i++){
+    if (dst[i].iov_len > INT32_MAX - total){
+      return false;
+    }
+    total += dst[i].iov_len;
+  }
+  for (i = 0; i < iovcnt; i++){
+    check_user_range(dst[i].iov_base, dst[i].iov_len, writable);
+  }
+
+  return true;
+}
+
+//read into each piece in turn, stopping at end of file
+int sys_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+  struct iovec iovs[IOV_MAX];
+  struct file_descriptor *filedescriptor;
+  int bytes_read = 0;
+  int i;
+
+  if (fd < 0 || !copy_in_iovecs(iovs, iov, iovcnt, true)){
+    return -1;
+  }
+
+  filedescriptor = lookup_fd(fd);
+  if (filedescriptor == NULL){
+    return -1;
+  }
+
+  for (i = 0; i < iovcnt; i++){
+    int n = read_buffer(fd, filedescriptor, iovs[i].iov_base,
+                        iovs[i].iov_len);
+    bytes_read += n;
+    if ((unsigned) n < iovs[i].iov_len){
+      break;
+    }
+  }
+
+  return bytes_read;
+}
+
+//write out each piece in turn, stopping at the first short write
+int sys_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+  struct iovec iovs[IOV_MAX];
+  struct file_descriptor *filedescriptor;
+  int bytes_written = 0;
+  int i;
+
+  if (fd < 0 || !copy_in_iovecs(iovs, iov, iovcnt, false)){
+    return -1;
+  }
+
+  filedescriptor = lookup_fd(fd);
+  if (filedescriptor == NULL && fd != STDOUT_FILENO){
+    return -1;
+  }
+
+  for (i = 0; i < iovcnt; i++){
+    int n = write_buffer(fd, filedescriptor, iovs[i].iov_base, iovs[i].iov_len);
+    if (n < 0){
+      return bytes_written > 0 ? bytes_written : -1;
+    }
+    bytes_written += n;
+    if ((unsigned) n < iovs[i].iov_len){
+      break;
+    }
+  }
+
+  return bytes_written;
+}
+
+//read at OFFSET without using or moving the file position
+int sys_pread(int fd, void *buffer, unsigned size, unsigned offset)
+{
+  if (size > INT32_MAX || offset > INT32_MAX){
+    return -1;
+  }
+  check_user_range(buffer, size, true);
+
+  struct file_descriptor *filedescriptor = lookup_fd(fd);
+  if (filedescriptor == NULL || filedescriptor->file == NULL){
+    return -1;
+  }
+
+  return file_read_at(filedescriptor->file, buffer, size, offset);
+}
+
+//write at OFFSET without using or moving the file position
+int sys_pwrite(int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  if (size > INT32_MAX || offset > INT32_MAX){
+    return -1;
+  }
+  check_user_range(buffer, size, false);
+
+  struct file_descriptor *filedescriptor = lookup_fd(fd);
+  if (filedescriptor == NULL || filedescriptor->file == NULL){
+    return -1;
+  }
+
+  return file_write_at(filedescriptor->file, buffer, size, offset);
+}
+
+//copy from one open file to another inside the kernel, starting at
+//each file's position; returns the number of bytes copied, 0 at end
+//of the source, or -1 if nothing could be written
+int sys_copy_file_range(int src_fd, int dst_fd, unsigned length)
+{
+  struct file_descriptor *src = lookup_fd(src_fd);
+  struct file_descriptor *dst = lookup_fd(dst_fd);
+
+  if (src == NULL || dst == NULL || src == dst
+      || src->file == NULL || dst->file == NULL)
+  {
+    return -1;
+  }
+
+  if (length > INT32_MAX)
+  {
+    length = INT32_MAX;
+  }
+
+  return file_copy(dst->file, src->file, length);
+}
+
 void
 syscall_init (void) 
 {
-  lock_init(&filesys_lock);
-
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -644,7 +948,7 @@ syscall_handler (struct intr_frame *f)
 {
 
   unsigned call_nr;
-  int args[3]; // It's 3 because that's the max number of arguments in all syscalls.
+  int args[4]; // It's 4 because that's the max number of arguments in all syscalls (pread/pwrite).
   copy_in (&call_nr, f->esp, sizeof call_nr); 
 
   // copy the args (depends on arg_cnt for every syscall).
@@ -680,6 +984,46 @@ copy_in (void *dst_, const void *usrc_, size_t size) {
 }
 
 
+static void
+copy_out (void *udst_, const void *src_, size_t size) {
+
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  for (; size > 0; size--, udst++, src++)
+    if (udst >= (uint8_t *) PHYS_BASE || !put_user (udst, *src))
+      thread_exit ();
+
+}
+
+
+/* Kills the process unless all SIZE bytes at user address BUFFER
+are mapped, and writable too if WRITABLE, for a system call that
+is about to hand BUFFER to the file system, which accesses it
+directly.  Probes one byte in each page the range touches;
+writing a byte back as it was leaves the buffer unchanged. */
+static void
+check_user_range (const void *buffer, unsigned size, bool writable)
+{
+  const uint8_t *p = buffer;
+  const uint8_t *end = p + size;
+
+  if (size == 0)
+    return;
+  if (p == NULL || end < p || end > (uint8_t *) PHYS_BASE)
+    sys_exit (-1);
+
+  for (; p < end; p = (const uint8_t *) pg_round_down (p) + PGSIZE)
+  {
+    uint8_t byte;
+
+    if (!get_user (&byte, p)
+        || (writable && !put_user ((uint8_t *) p, byte)))
+      sys_exit (-1);
+  }
+}
+
+
 /* Copies a byte from user address USRC to kernel address DST. USRC must
 be below PHYS_BASE. Returns true if successful, false if a segfault
 occurred. Unlike the one posted on the p2 website, this one takes two
@@ -745,52 +1089,70 @@ copy_in_string (const char *us)
   //NOTE: do this after calling copy_in_string in other sys functions
 }
 
+//the file table is an array of descriptors indexed by handle, so
+//looking one up is just an index; 0 and 1 are the console and never
+//have an entry
+#define FIRST_FD 2
+//slots in a new table, which doubles whenever it fills up
+#define FD_TABLE_INIT 16
+
 //looking up function
 struct file_descriptor *lookup_fd(int handle){
 
   struct thread *curr = thread_current();
 
-  struct list_elem *e;
+  if (handle < 0 || handle >= curr->fd_cnt){
+    return NULL;
+  }
 
-  for (e=list_begin(&curr->files); e != list_end(&curr->files); e = list_next(e)){
-    struct file_descriptor *fd = list_entry(e, struct file_descriptor, elem);
+  return curr->fds[handle];
 
-    if (fd->handle == handle){
-      return fd;
+}
+
+//puts FILE or DIR in the lowest free slot of the table, growing the
+//table if it's full. returns the new handle, or -1 if out of memory
+static int add_to_file_table(struct file *file, struct dir *dir){
+
+  struct thread *curr = thread_current();
+  struct file_descriptor *fd;
+  int handle;
+
+  for (handle = FIRST_FD; handle < curr->fd_cnt; handle++){
+    if (curr->fds[handle] == NULL){
+      break;
     }
   }
 
-  return NULL;
+  if (handle >= curr->fd_cnt){
+    int new_cnt = curr->fd_cnt > 0 ? curr->fd_cnt * 2 : FD_TABLE_INIT;
+    struct file_descriptor **fds = realloc(curr->fds, new_cnt * sizeof *fds);
+    if (fds == NULL){
+      return -1;
+    }
+    memset(fds + curr->fd_cnt, 0, (new_cnt - curr->fd_cnt) * sizeof *fds);
+    curr->fds = fds;
+    curr->fd_cnt = new_cnt;
+  }
+
+  fd = malloc(sizeof *fd);
+  if (fd == NULL){
+    return -1;
+  }
+  fd->handle = handle;
+  fd->file = file;
+  fd->dir = dir;
+  curr->fds[handle] = fd;
 
+  return handle;
 }
 
 int add_dir_to_file_table(struct dir *dir)
 {
-  struct thread *curr = thread_current();
-  struct file_descriptor *fd = palloc_get_page(0);
-
-  fd->handle = curr->next_file;
-  fd->file = NULL;
-  fd->dir = dir;
-  list_push_back(&curr->files, &fd->elem);
-
-  curr->next_file += 1;
-  return fd->handle;
+  return add_to_file_table(NULL, dir);
 }
 
 int add_file_to_file_table(struct file *add_me_file){
-
-  struct thread *curr = thread_current();
-  struct file_descriptor *fd = palloc_get_page(0);
-
-  //should this loop through fd numbers to find the next available or is setting the next enough?
-  fd->handle = curr->next_file;
-  fd->file = add_me_file;
-  fd->dir = NULL;
-  list_push_back(&curr->files, &fd->elem);
-
-  curr->next_file += 1;
-  return fd->handle;
+  return add_to_file_table(add_me_file, NULL);
 }
 
 void close_file(int fd){
@@ -798,23 +1160,27 @@ void close_file(int fd){
   struct file_descriptor *filedesc = lookup_fd(fd);
 
   if (filedesc == NULL){
-    return -1;
+    return;
   }
 
   //find file_close() in file.c
   file_close(filedesc->file);
-  list_remove(&filedesc->elem);
+  dir_close(filedesc->dir);
+  thread_current()->fds[fd] = NULL;
 
-  palloc_free_page(filedesc);
+  free(filedesc);
 }
 
+//closes everything the process still has open, when it exits
 void kill_the_table(void){
   struct thread *curr = thread_current();
-  struct list_elem *e;
+  int handle;
 
-  while (!list_empty(&curr->files)){
-    e = list_pop_front(&curr->files);
-    struct file_descriptor *fd = list_entry(e, struct file_descriptor, elem);
-    file_close(fd->file);
+  for (handle = 0; handle < curr->fd_cnt; handle++){
+    close_file(handle);
   }
+
+  free(curr->fds);
+  curr->fds = NULL;
+  curr->fd_cnt = 0;
 }
@@ -2,5 +2,6 @@
 #define USERPROG_SYSCALL_H
 
 void syscall_init (void);
+void kill_the_table (void);
 
 #endif /* userprog/syscall.h */